@@ -0,0 +1,124 @@
+//Sony Computer Entertainment Confidential
+#ifndef _H_pthread_bench
+#define _H_pthread_bench
+
+#include "pthread/include/pthread.h"
+#include <stdio.h>
+
+/*
+ * Helpers shared by the benchmarks.  Every benchmark is a standalone
+ * program linked with the library, printing one line per measure.
+ *
+ * bench_run starts the workers together: each worker calls
+ * BENCH_START() first, and the time is taken from the common start to
+ * the end of the last worker.  With a duration, the workers run until
+ * BENCH_RUNNING() turns false instead of a fixed number of operations.
+ */
+
+#define BENCH_MAX_THREADS   PTHREAD_THREADS_MAX
+
+typedef struct bench_thread_t
+{
+  int            index;
+  void          *ctx;           // Shared by the workers of a run
+  unsigned long  ops;           // Operations done, counted by the worker
+  SceUInt64      idle;          // Microseconds spent waiting, if measured
+} bench_thread_t;
+
+static pthread_barrier_t bench_barrier;
+static volatile long bench_stop;
+
+#define BENCH_START()       pthread_barrier_wait(&bench_barrier)
+#define BENCH_RUNNING()     (ATOMIC_LOAD(&bench_stop, ATOMIC_RELAXED) == 0)
+
+
+/* Microseconds */
+static inline SceUInt64 bench_now(void)
+{
+  return sceKernelGetProcessTimeWide();
+}
+
+
+/* xorshift, for the workers picking random objects */
+static inline unsigned long bench_random(unsigned long *state)
+{
+  unsigned long x = *state;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+
+/*
+ * Run body on n workers, for duration microseconds if not 0.  Returns
+ * the elapsed microseconds, or 0 if a worker could not be created.
+ */
+
+static inline SceUInt64 bench_run(int n, void *(*body)(void *), bench_thread_t *threads,
+                                  void *ctx, SceUInt64 duration)
+{
+  pthread_t th[BENCH_MAX_THREADS];
+  SceUInt64 t0;
+  int i, created;
+
+  bench_stop = 0;
+  pthread_barrier_init(&bench_barrier, NULL, n + 1);
+  for (created = 0; created < n; created++)
+    {
+      threads[created].index = created;
+      threads[created].ctx = ctx;
+      threads[created].ops = 0;
+      threads[created].idle = 0;
+      if (pthread_create(&th[created], NULL, body, &threads[created]) != 0)
+        break;
+    }
+  if (created < n)
+    {
+      printf("bench: cannot create %d threads\n", n);
+      // The workers created are stuck at the start barrier
+      return 0;
+    }
+
+  BENCH_START();
+  t0 = bench_now();
+  if (duration != 0)
+    {
+      sceKernelDelayThread((SceUInt)duration);
+      ATOMIC_STORE(&bench_stop, 1, ATOMIC_RELAXED);
+    }
+  for (i = 0; i < n; i++)
+    pthread_join(th[i], NULL);
+  t0 = bench_now() - t0;
+
+  pthread_barrier_destroy(&bench_barrier);
+  return t0;
+}
+
+
+static inline unsigned long bench_ops(const bench_thread_t *threads, int n)
+{
+  unsigned long ops = 0;
+  int i;
+
+  for (i = 0; i < n; i++)
+    ops += threads[i].ops;
+  return ops;
+}
+
+
+/* One line: operations per millisecond and nanoseconds per operation */
+static inline void bench_report(const char *name, int n, unsigned long ops, SceUInt64 usec)
+{
+  if (usec == 0 || ops == 0)
+    {
+      printf("%-32s %3d threads  no result\n", name, n);
+      return;
+    }
+  printf("%-32s %3d threads  %10lu ops/ms  %8lu ns/op\n", name, n,
+         (unsigned long)(ops * 1000ULL / usec), (unsigned long)(usec * 1000ULL / ops));
+}
+
+#endif
@@ -0,0 +1,91 @@
+//Sony Computer Entertainment Confidential
+#include "bench/bench.h"
+
+/*
+ * Idle time at a barrier, with pthread_barrier_wait against the split
+ * phase pthread_barrier_arrive_np / pthread_barrier_wait_token_np.
+ * Every phase, each worker does an unbalanced amount of work that the
+ * others depend on, then the same amount of work that nobody depends
+ * on.  The blocking wait sits between the two, the split phase wait
+ * overlaps the second with the arrival of the slow workers.
+ */
+
+#define ROUNDS          1000
+#define WORK            2000            // Loop iterations of the shortest work
+
+typedef struct
+{
+  pthread_barrier_t barrier;
+  int               split;
+} ctx_t;
+
+
+static void work(unsigned long n)
+{
+  volatile unsigned long sink = 0;
+
+  while (n-- > 0)
+    sink += n;
+}
+
+
+static void *worker(void *arg)
+{
+  bench_thread_t *t = (bench_thread_t *)arg;
+  ctx_t *c = (ctx_t *)t->ctx;
+  pthread_barrier_token_t token;
+  unsigned long seed = 88172645UL + t->index;
+  SceUInt64 t0;
+  int i;
+
+  BENCH_START();
+  for (i = 0; i < ROUNDS; i++)
+    {
+      // Dependent work, from 1 to 4 times WORK
+      work(WORK * (1 + bench_random(&seed) % 4));
+
+      if (c->split)
+        {
+          pthread_barrier_arrive_np(&c->barrier, &token);
+          work(WORK);
+          t0 = bench_now();
+          pthread_barrier_wait_token_np(&c->barrier, &token);
+          t->idle += bench_now() - t0;
+        }
+      else
+        {
+          t0 = bench_now();
+          pthread_barrier_wait(&c->barrier);
+          t->idle += bench_now() - t0;
+          work(WORK);
+        }
+      t->ops++;
+    }
+  return NULL;
+}
+
+
+int main(void)
+{
+  static bench_thread_t threads[8];
+  ctx_t c;
+  SceUInt64 usec, idle;
+  int n, i;
+
+  for (n = 2; n <= 8; n *= 2)
+    for (c.split = 0; c.split <= 1; c.split++)
+      {
+        pthread_barrier_init(&c.barrier, NULL, n);
+        usec = bench_run(n, worker, threads, &c, 0);
+        pthread_barrier_destroy(&c.barrier);
+
+        for (idle = 0, i = 0; i < n; i++)
+          idle += threads[i].idle;
+        bench_report(c.split ? "split phase" : "blocking", n, ROUNDS, usec);
+        if (usec != 0)
+          printf("%-32s %3d threads  idle %lu us per thread, %lu%% of the time\n",
+                 c.split ? "split phase" : "blocking", n, (unsigned long)(idle / n),
+                 (unsigned long)(idle * 100 / (usec * n)));
+      }
+  return 0;
+}
@@ -0,0 +1,69 @@
+//Sony Computer Entertainment Confidential
+#include "bench/bench.h"
+
+/*
+ * Cost of a barrier phase, central against tree barriers, from 2 to
+ * PTHREAD_THREADS_MAX threads.  The workers do nothing but wait on the
+ * barrier, so a phase is the pure synchronization cost.
+ */
+
+#define ROUNDS          10000
+
+typedef struct
+{
+  pthread_barrier_t barrier;
+} ctx_t;
+
+
+static void *worker(void *arg)
+{
+  bench_thread_t *t = (bench_thread_t *)arg;
+  ctx_t *c = (ctx_t *)t->ctx;
+  int i;
+
+  BENCH_START();
+  for (i = 0; i < ROUNDS; i++)
+    pthread_barrier_wait(&c->barrier);
+  return NULL;
+}
+
+
+static void measure(const char *name, int type, int fanin, int n)
+{
+  static bench_thread_t threads[BENCH_MAX_THREADS];
+  pthread_barrierattr_t attr;
+  ctx_t c;
+  SceUInt64 usec;
+
+  pthread_barrierattr_init(&attr);
+  pthread_barrierattr_settype_np(&attr, type);
+  if (fanin != 0)
+    pthread_barrierattr_setfanin_np(&attr, fanin);
+  if (pthread_barrier_init(&c.barrier, &attr, n) != 0)
+    {
+      printf("%s: cannot initialize the barrier\n", name);
+      return;
+    }
+
+  usec = bench_run(n, worker, threads, &c, 0);
+  // One operation is one phase
+  bench_report(name, n, ROUNDS, usec);
+
+  pthread_barrier_destroy(&c.barrier);
+  pthread_barrierattr_destroy(&attr);
+}
+
+
+int main(void)
+{
+  int n;
+
+  for (n = 2; n <= PTHREAD_THREADS_MAX; n *= 2)
+    {
+      measure("central", PTHREAD_BARRIER_CENTRAL_NP, 0, n);
+      measure("tree, fan-in 2", PTHREAD_BARRIER_TREE_NP, 2, n);
+      measure("tree, fan-in 4", PTHREAD_BARRIER_TREE_NP, 4, n);
+      measure("tree, fan-in 8", PTHREAD_BARRIER_TREE_NP, 8, n);
+    }
+  return 0;
+}
@@ -0,0 +1,85 @@
+//Sony Computer Entertainment Confidential
+#include "bench/bench.h"
+
+/*
+ * Latency of pthread_create followed by pthread_join, from one thread.
+ * Without the thread cache, every creation makes a new kernel thread:
+ * a name of its own per thread defeats the cache, whose kernel threads
+ * are only reused under the same name.  With the cache, the kernel
+ * thread of the previous creation is restarted.  The last measure runs
+ * the threads on a stack supplied with pthread_attr_setstack.
+ */
+
+#define CREATES         2000
+#define STACK_SIZE      (16 * 1024)
+
+enum { UNCACHED, CACHED, SETSTACK };
+
+static const char *names[] = { "create+join, uncached", "create+join, cached", "create+join, setstack" };
+
+typedef struct
+{
+  int             method;
+  int             failed;
+} ctx_t;
+
+static long long stack[STACK_SIZE / sizeof(long long)];      // 8 byte aligned
+
+
+static void *body(void *arg)
+{
+  return arg;
+}
+
+
+static void *worker(void *arg)
+{
+  bench_thread_t *t = (bench_thread_t *)arg;
+  ctx_t *c = (ctx_t *)t->ctx;
+  pthread_attr_t attr;
+  pthread_t th;
+  char name[16];
+  int i;
+
+  pthread_attr_init(&attr);
+  if (c->method == SETSTACK && pthread_attr_setstack(&attr, stack, sizeof(stack)) != 0)
+    c->failed = 1;
+
+  BENCH_START();
+  for (i = 0; i < CREATES && !c->failed; i++)
+    {
+      if (c->method == UNCACHED)
+        {
+          snprintf(name, sizeof(name), "bench%lu", t->ops);
+          pthread_attr_setname_np(&attr, name);
+        }
+      if (pthread_create(&th, &attr, body, NULL) != 0)
+        {
+          c->failed = 1;
+          break;
+        }
+      pthread_join(th, NULL);
+      t->ops++;
+    }
+  pthread_attr_destroy(&attr);
+  return NULL;
+}
+
+
+int main(void)
+{
+  static bench_thread_t threads[1];
+  ctx_t c;
+  SceUInt64 usec;
+
+  for (c.method = UNCACHED; c.method <= SETSTACK; c.method++)
+    {
+      c.failed = 0;
+      usec = bench_run(1, worker, threads, &c, 0);
+      if (c.failed)
+        printf("%s: pthread_create failed\n", names[c.method]);
+      else
+        bench_report(names[c.method], 1, bench_ops(threads, 1), usec);
+    }
+  return 0;
+}
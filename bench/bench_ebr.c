@@ -0,0 +1,119 @@
+//Sony Computer Entertainment Confidential
+#include "bench/bench.h"
+#include <stdlib.h> // malloc, free
+
+/*
+ * Read throughput of a shared object protected by epoch based
+ * reclamation, against the same object protected by a mutex.  Reader
+ * threads read the current object in a loop, while one writer replaces
+ * it and retires the old one, or frees it under the mutex.
+ */
+
+#define DURATION        1000000         // Microseconds per measure
+
+typedef struct node_t
+{
+  pthread_ebr_head_t    ebr;            // First, for the reclamation
+  unsigned long         value;
+} node_t;
+
+typedef struct
+{
+  int                   locked;
+  node_t * volatile     current;
+  pthread_mutex_t       mutex;
+  volatile long         sum;
+} ctx_t;
+
+
+static void release(pthread_ebr_head_t *head)
+{
+  free(head);
+}
+
+
+static node_t *create(unsigned long value)
+{
+  node_t *node = (node_t *)malloc(sizeof(node_t));
+
+  node->value = value;
+  return node;
+}
+
+
+static void *worker(void *arg)
+{
+  bench_thread_t *t = (bench_thread_t *)arg;
+  ctx_t *c = (ctx_t *)t->ctx;
+  unsigned long sum = 0;
+  node_t *node;
+
+  BENCH_START();
+  if (t->index == 0)
+    {
+      // The writer, its replacements are not counted
+      while (BENCH_RUNNING())
+        {
+          node = create(sum++);
+          if (c->locked)
+            {
+              pthread_mutex_lock(&c->mutex);
+              node = (node_t *)ATOMIC_SWAP_PTR((void * volatile *)&c->current, node, ATOMIC_ACQ_REL);
+              free(node);
+              pthread_mutex_unlock(&c->mutex);
+            }
+          else
+            {
+              node = (node_t *)ATOMIC_SWAP_PTR((void * volatile *)&c->current, node, ATOMIC_ACQ_REL);
+              pthread_ebr_retire_np(&node->ebr, release);
+            }
+          sched_yield();
+        }
+      pthread_ebr_reclaim_np();
+      return NULL;
+    }
+
+  while (BENCH_RUNNING())
+    {
+      if (c->locked)
+        {
+          pthread_mutex_lock(&c->mutex);
+          sum += c->current->value;
+          pthread_mutex_unlock(&c->mutex);
+        }
+      else
+        {
+          pthread_ebr_enter_np();
+          node = (node_t *)ATOMIC_LOAD_PTR((void * volatile *)&c->current, ATOMIC_ACQUIRE);
+          sum += node->value;
+          pthread_ebr_exit_np();
+        }
+      t->ops++;
+    }
+  ATOMIC_FETCH_ADD(&c->sum, (long)sum, ATOMIC_RELAXED);      // Keeps the reads
+  return NULL;
+}
+
+
+int main(void)
+{
+  static bench_thread_t threads[8];
+  static ctx_t c;
+  SceUInt64 usec;
+  int n;
+
+  pthread_mutex_init(&c.mutex, NULL);
+  c.current = create(0);
+
+  for (n = 1; n <= 7; n = n * 2 + 1)
+    for (c.locked = 0; c.locked <= 1; c.locked++)
+      {
+        usec = bench_run(n + 1, worker, threads, &c, DURATION);
+        // One operation is one read, the thread count includes the writer
+        bench_report(c.locked ? "mutex reads" : "ebr reads", n + 1, bench_ops(threads, n + 1), usec);
+      }
+
+  free(c.current);
+  pthread_mutex_destroy(&c.mutex);
+  return 0;
+}
@@ -0,0 +1,162 @@
+//Sony Computer Entertainment Confidential
+#include "bench/bench.h"
+#include <stdlib.h> // malloc, free
+
+/*
+ * Throughput of the hash map against a chained hash table protected by
+ * one mutex, with 1 to 8 threads.  The lookups pick random keys among
+ * the ones inserted beforehand; the updates insert a key private to
+ * the thread and remove it, one operation being both.
+ */
+
+#define DURATION        1000000         // Microseconds per measure
+#define KEYS            4096
+#define BUCKETS         4096
+
+typedef struct entry_t
+{
+  struct entry_t      *next;
+  unsigned long        key;
+  void                *value;
+} entry_t;
+
+typedef struct
+{
+  pthread_mutex_t      mutex;
+  entry_t             *buckets[BUCKETS];
+} locked_t;
+
+typedef struct
+{
+  int                  locked;
+  int                  update;
+  pthread_hashmap_t    map;
+  locked_t             l;
+} ctx_t;
+
+
+static int locked_lookup(locked_t *l, unsigned long key, void **value)
+{
+  entry_t *e;
+  int result = ENOENT;
+
+  pthread_mutex_lock(&l->mutex);
+  for (e = l->buckets[key % BUCKETS]; e != NULL; e = e->next)
+    if (e->key == key)
+      {
+        *value = e->value;
+        result = 0;
+        break;
+      }
+  pthread_mutex_unlock(&l->mutex);
+  return result;
+}
+
+
+static int locked_insert(locked_t *l, unsigned long key, void *value)
+{
+  entry_t *e = (entry_t *)malloc(sizeof(entry_t));
+
+  if (e == NULL)
+    return ENOMEM;
+  e->key = key;
+  e->value = value;
+  pthread_mutex_lock(&l->mutex);
+  e->next = l->buckets[key % BUCKETS];
+  l->buckets[key % BUCKETS] = e;
+  pthread_mutex_unlock(&l->mutex);
+  return 0;
+}
+
+
+static int locked_remove(locked_t *l, unsigned long key)
+{
+  entry_t **p, *e = NULL;
+
+  pthread_mutex_lock(&l->mutex);
+  for (p = &l->buckets[key % BUCKETS]; *p != NULL; p = &(*p)->next)
+    if ((*p)->key == key)
+      {
+        e = *p;
+        *p = e->next;
+        break;
+      }
+  pthread_mutex_unlock(&l->mutex);
+  free(e);
+  return e != NULL ? 0 : ENOENT;
+}
+
+
+static void *worker(void *arg)
+{
+  bench_thread_t *t = (bench_thread_t *)arg;
+  ctx_t *c = (ctx_t *)t->ctx;
+  unsigned long seed = t->index + 1, key;
+  void *value;
+
+  BENCH_START();
+  while (BENCH_RUNNING())
+    {
+      if (c->update)
+        {
+          // Above the keys of the lookups, and different for every thread
+          key = KEYS + 1 + t->index * BUCKETS + (t->ops % BUCKETS);
+          if (c->locked)
+            {
+              locked_insert(&c->l, key, t);
+              locked_remove(&c->l, key);
+            }
+          else
+            {
+              pthread_hashmap_insert_np(&c->map, (const void *)key, t);
+              pthread_hashmap_remove_np(&c->map, (const void *)key, NULL);
+            }
+        }
+      else
+        {
+          key = bench_random(&seed) % KEYS + 1;
+          if (c->locked)
+            locked_lookup(&c->l, key, &value);
+          else
+            pthread_hashmap_lookup_np(&c->map, (const void *)key, &value);
+        }
+      t->ops++;
+    }
+  return NULL;
+}
+
+
+int main(void)
+{
+  static bench_thread_t threads[8];
+  static ctx_t c;
+  char name[40];
+  SceUInt64 usec;
+  unsigned long key;
+  int n;
+
+  pthread_mutex_init(&c.l.mutex, NULL);
+  if (pthread_hashmap_init_np(&c.map, BUCKETS, NULL, NULL) != 0)
+    return 1;
+  for (key = 1; key <= KEYS; key++)
+    {
+      pthread_hashmap_insert_np(&c.map, (const void *)key, (void *)key);
+      locked_insert(&c.l, key, (void *)key);
+    }
+
+  for (c.update = 0; c.update <= 1; c.update++)
+    for (n = 1; n <= 8; n *= 2)
+      for (c.locked = 0; c.locked <= 1; c.locked++)
+        {
+          usec = bench_run(n, worker, threads, &c, DURATION);
+          snprintf(name, sizeof(name), "%s %s", c.locked ? "mutex table" : "pthread_hashmap",
+                   c.update ? "insert+remove" : "lookup");
+          bench_report(name, n, bench_ops(threads, n), usec);
+        }
+
+  for (key = 1; key <= KEYS; key++)
+    locked_remove(&c.l, key);
+  pthread_hashmap_destroy_np(&c.map);
+  pthread_mutex_destroy(&c.l.mutex);
+  return 0;
+}
@@ -0,0 +1,84 @@
+//Sony Computer Entertainment Confidential
+#include "bench/bench.h"
+
+/*
+ * Throughput of the lock free LIFO against a stack protected by a
+ * mutex, with 1 to 8 threads.  Every thread pops a node and pushes it
+ * back in a loop, the usage of a free list; one operation is a pop and
+ * a push.
+ */
+
+#define DURATION        1000000         // Microseconds per measure
+#define NODES           256
+
+typedef struct
+{
+  int                  locked;
+  pthread_lifo_t       lifo;
+  pthread_mutex_t      mutex;
+  pthread_lifo_node_t *top;             // Protected by the mutex
+  pthread_lifo_node_t  nodes[2][NODES]; // Of the LIFO and of the stack
+} ctx_t;
+
+
+static void *worker(void *arg)
+{
+  bench_thread_t *t = (bench_thread_t *)arg;
+  ctx_t *c = (ctx_t *)t->ctx;
+  pthread_lifo_node_t *node;
+
+  BENCH_START();
+  while (BENCH_RUNNING())
+    {
+      if (c->locked)
+        {
+          pthread_mutex_lock(&c->mutex);
+          node = c->top;
+          c->top = node->next;
+          pthread_mutex_unlock(&c->mutex);
+
+          pthread_mutex_lock(&c->mutex);
+          node->next = c->top;
+          c->top = node;
+          pthread_mutex_unlock(&c->mutex);
+        }
+      else
+        {
+          node = pthread_lifo_pop_np(&c->lifo);
+          pthread_lifo_push_np(&c->lifo, node);
+        }
+      t->ops++;
+    }
+  return NULL;
+}
+
+
+int main(void)
+{
+  static bench_thread_t threads[8];
+  static ctx_t c;
+  SceUInt64 usec;
+  int n, i;
+
+  pthread_lifo_init_np(&c.lifo);
+  pthread_mutex_init(&c.mutex, NULL);
+  // More nodes than threads, so that no pop finds the stack empty
+  for (i = 0; i < NODES - 1; i++)
+    {
+      c.nodes[0][i].next = &c.nodes[0][i + 1];
+      c.nodes[1][i].next = &c.nodes[1][i + 1];
+    }
+  c.nodes[0][NODES - 1].next = c.nodes[1][NODES - 1].next = NULL;
+  pthread_lifo_push_chain_np(&c.lifo, &c.nodes[0][0], &c.nodes[0][NODES - 1]);
+  c.top = &c.nodes[1][0];
+
+  for (n = 1; n <= 8; n *= 2)
+    for (c.locked = 0; c.locked <= 1; c.locked++)
+      {
+        usec = bench_run(n, worker, threads, &c, DURATION);
+        bench_report(c.locked ? "mutex stack" : "pthread_lifo", n, bench_ops(threads, n), usec);
+      }
+
+  pthread_mutex_destroy(&c.mutex);
+  return 0;
+}
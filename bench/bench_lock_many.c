@@ -0,0 +1,142 @@
+//Sony Computer Entertainment Confidential
+#include "bench/bench.h"
+
+/*
+ * pthread_mutex_lock_many_np against the hand coded ways of locking
+ * two or three mutexes: sorting them by address, and a trylock loop
+ * backing off by releasing everything.  Every worker moves a token
+ * between random mutexes of a small set, so the contention is high.
+ */
+
+#define MUTEXES         16
+#define DURATION        1000000         // Microseconds per measure
+
+enum { LOCK_MANY, ORDERED, TRYLOCK };
+
+static const char *names[] = { "lock_many_np", "address ordered", "trylock and back off" };
+
+typedef struct
+{
+  int             method;
+  pthread_mutex_t mutexes[MUTEXES];
+  long            tokens[MUTEXES];
+} ctx_t;
+
+
+static int pick(ctx_t *c, unsigned long *seed, pthread_mutex_t **set)
+{
+  int n, i, j;
+
+  n = 2 + (int)(bench_random(seed) & 1);
+  for (i = 0; i < n; i++)
+    {
+    again:
+      set[i] = &c->mutexes[bench_random(seed) % MUTEXES];
+      for (j = 0; j < i; j++)
+        if (set[j] == set[i])
+          goto again;
+    }
+  return n;
+}
+
+
+static void lock_ordered(pthread_mutex_t **set, int n)
+{
+  pthread_mutex_t *m;
+  int i, j;
+
+  for (i = 1; i < n; i++)
+    for (j = i; j > 0 && set[j] < set[j - 1]; j--)
+      {
+        m = set[j];
+        set[j] = set[j - 1];
+        set[j - 1] = m;
+      }
+  for (i = 0; i < n; i++)
+    pthread_mutex_lock(set[i]);
+}
+
+
+static void lock_trylock(pthread_mutex_t **set, int n)
+{
+  int i, j;
+
+  for (;;)
+    {
+      pthread_mutex_lock(set[0]);
+      for (i = 1; i < n; i++)
+        if (pthread_mutex_trylock(set[i]) != 0)
+          break;
+      if (i == n)
+        return;
+      for (j = i - 1; j >= 0; j--)
+        pthread_mutex_unlock(set[j]);
+      sched_yield();
+    }
+}
+
+
+static void *worker(void *arg)
+{
+  bench_thread_t *t = (bench_thread_t *)arg;
+  ctx_t *c = (ctx_t *)t->ctx;
+  pthread_mutex_t *set[3];
+  unsigned long seed = 2463534242UL + t->index;
+  int n, i;
+
+  BENCH_START();
+  while (BENCH_RUNNING())
+    {
+      n = pick(c, &seed, set);
+      switch (c->method)
+        {
+        case LOCK_MANY: pthread_mutex_lock_many_np(set, n); break;
+        case ORDERED:   lock_ordered(set, n); break;
+        case TRYLOCK:   lock_trylock(set, n); break;
+        }
+
+      // Move a token from the first mutex to the others
+      for (i = 1; i < n; i++)
+        c->tokens[set[i] - c->mutexes]++;
+      c->tokens[set[0] - c->mutexes] -= n - 1;
+
+      if (c->method == LOCK_MANY)
+        pthread_mutex_unlock_many_np(set, n);
+      else
+        for (i = n - 1; i >= 0; i--)
+          pthread_mutex_unlock(set[i]);
+      t->ops++;
+    }
+  return NULL;
+}
+
+
+int main(void)
+{
+  static const int counts[] = { 1, 2, 3, 4, 8 };
+  static bench_thread_t threads[8];
+  static ctx_t c;
+  SceUInt64 usec;
+  long sum;
+  int k, i, n;
+
+  for (i = 0; i < MUTEXES; i++)
+    pthread_mutex_init(&c.mutexes[i], NULL);
+
+  for (c.method = LOCK_MANY; c.method <= TRYLOCK; c.method++)
+    for (k = 0; k < (int)(sizeof(counts) / sizeof(counts[0])); k++)
+      {
+        n = counts[k];
+        usec = bench_run(n, worker, threads, &c, DURATION);
+        bench_report(names[c.method], n, bench_ops(threads, n), usec);
+      }
+
+  // The tokens only move, a lost update shows as a non zero sum
+  for (sum = 0, i = 0; i < MUTEXES; i++)
+    sum += c.tokens[i];
+  printf("token sum %ld (expected 0)\n", sum);
+
+  for (i = 0; i < MUTEXES; i++)
+    pthread_mutex_destroy(&c.mutexes[i]);
+  return sum != 0;
+}
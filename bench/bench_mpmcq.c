@@ -0,0 +1,122 @@
+//Sony Computer Entertainment Confidential
+#include "bench/bench.h"
+
+/*
+ * Throughput of the MPMC queue against a ring protected by a mutex
+ * and two conditions, the usual job queue, with 1 to 8 producers and
+ * consumers.  Every element pushed is popped: the producers share the
+ * pushes and the consumers the pops evenly.
+ */
+
+#define ITEMS           840000          // Divisible by 1 to 8
+#define QUEUE_SIZE      256
+
+typedef struct
+{
+  pthread_mutex_t  mutex;
+  pthread_cond_t   notempty;
+  pthread_cond_t   notfull;
+  void            *ring[QUEUE_SIZE];
+  unsigned long    head, tail;
+} locked_t;
+
+typedef struct
+{
+  int              locked;
+  int              producers;
+  int              consumers;
+  pthread_mpmcq_t  q;
+  locked_t         l;
+} ctx_t;
+
+
+static void locked_push(locked_t *l, void *data)
+{
+  pthread_mutex_lock(&l->mutex);
+  while (l->tail - l->head == QUEUE_SIZE)
+    pthread_cond_wait(&l->notfull, &l->mutex);
+  l->ring[l->tail++ % QUEUE_SIZE] = data;
+  pthread_cond_signal(&l->notempty);
+  pthread_mutex_unlock(&l->mutex);
+}
+
+
+static void *locked_pop(locked_t *l)
+{
+  void *data;
+
+  pthread_mutex_lock(&l->mutex);
+  while (l->tail == l->head)
+    pthread_cond_wait(&l->notempty, &l->mutex);
+  data = l->ring[l->head++ % QUEUE_SIZE];
+  pthread_cond_signal(&l->notfull);
+  pthread_mutex_unlock(&l->mutex);
+  return data;
+}
+
+
+static void *worker(void *arg)
+{
+  bench_thread_t *t = (bench_thread_t *)arg;
+  ctx_t *c = (ctx_t *)t->ctx;
+  unsigned long i, n;
+  void *data;
+
+  BENCH_START();
+  if (t->index < c->producers)
+    {
+      n = ITEMS / c->producers;
+      for (i = 1; i <= n; i++)
+        if (c->locked)
+          locked_push(&c->l, (void *)i);
+        else
+          pthread_mpmcq_push_np(&c->q, (void *)i);
+    }
+  else
+    {
+      n = ITEMS / c->consumers;
+      for (i = 0; i < n; i++)
+        if (c->locked)
+          data = locked_pop(&c->l);
+        else
+          pthread_mpmcq_pop_np(&c->q, &data);
+    }
+  t->ops = n;
+  return NULL;
+}
+
+
+int main(void)
+{
+  static const int counts[] = { 1, 2, 4, 8 };
+  static bench_thread_t threads[16];
+  static ctx_t c;
+  char name[40];
+  SceUInt64 usec;
+  int p, k;
+
+  pthread_mutex_init(&c.l.mutex, NULL);
+  pthread_cond_init(&c.l.notempty, NULL);
+  pthread_cond_init(&c.l.notfull, NULL);
+  pthread_mpmcq_init_np(&c.q, QUEUE_SIZE);
+
+  for (c.locked = 0; c.locked <= 1; c.locked++)
+    for (p = 0; p < 4; p++)
+      for (k = 0; k < 4; k++)
+        {
+          c.producers = counts[p];
+          c.consumers = counts[k];
+          c.l.head = c.l.tail = 0;
+          usec = bench_run(c.producers + c.consumers, worker, threads, &c, 0);
+          snprintf(name, sizeof(name), "%s %dP/%dC", c.locked ? "mutex ring" : "mpmcq",
+                   c.producers, c.consumers);
+          // One operation is one element through the queue
+          bench_report(name, c.producers + c.consumers, ITEMS, usec);
+        }
+
+  pthread_mpmcq_destroy_np(&c.q);
+  pthread_cond_destroy(&c.l.notfull);
+  pthread_cond_destroy(&c.l.notempty);
+  pthread_mutex_destroy(&c.l.mutex);
+  return 0;
+}
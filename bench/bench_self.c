@@ -0,0 +1,57 @@
+//Sony Computer Entertainment Confidential
+#include "bench/bench.h"
+
+/*
+ * Cost of pthread_self against the kernel calls it once needed: the
+ * thread id, then the thread information holding the name, in which
+ * the address of the thread storage is encoded.
+ */
+
+#define CALLS           1000000
+
+typedef struct
+{
+  int               kernel;
+  volatile long     sum;
+} ctx_t;
+
+
+static void *worker(void *arg)
+{
+  bench_thread_t *t = (bench_thread_t *)arg;
+  ctx_t *c = (ctx_t *)t->ctx;
+  SceKernelThreadInfo info;
+  unsigned long sum = 0;
+  int i;
+
+  BENCH_START();
+  for (i = 0; i < CALLS; i++)
+    {
+      if (c->kernel)
+        {
+          info.size = sizeof(SceKernelThreadInfo);
+          sceKernelGetThreadInfo(sceKernelGetThreadId(), &info);
+          sum += (unsigned char)info.name[0];
+        }
+      else
+        sum += (unsigned long)pthread_self();
+    }
+  t->ops = CALLS;
+  ATOMIC_FETCH_ADD(&c->sum, (long)sum, ATOMIC_RELAXED);      // Keeps the calls
+  return NULL;
+}
+
+
+int main(void)
+{
+  static bench_thread_t threads[1];
+  static ctx_t c;
+  SceUInt64 usec;
+
+  for (c.kernel = 0; c.kernel <= 1; c.kernel++)
+    {
+      usec = bench_run(1, worker, threads, &c, 0);
+      bench_report(c.kernel ? "sceKernelGetThreadInfo" : "pthread_self", 1, bench_ops(threads, 1), usec);
+    }
+  return 0;
+}
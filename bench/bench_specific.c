@@ -0,0 +1,76 @@
+//Sony Computer Entertainment Confidential
+#include "bench/bench.h"
+
+/*
+ * Cost of the calls made on every access to thread specific data and
+ * at every cancellation point: pthread_getspecific,
+ * pthread_setspecific and pthread_testcancel, with 1 and 3 threads
+ * calling them at the same time.  They only touch the data of the
+ * calling thread, so the cost per call should not change with the
+ * number of threads.
+ */
+
+#define CALLS           1000000
+
+enum { GET, SET, TESTCANCEL };
+
+static const char *names[] = { "pthread_getspecific", "pthread_setspecific", "pthread_testcancel" };
+
+typedef struct
+{
+  int               method;
+  pthread_key_t     key;
+  volatile long     sum;
+} ctx_t;
+
+
+static void *worker(void *arg)
+{
+  bench_thread_t *t = (bench_thread_t *)arg;
+  ctx_t *c = (ctx_t *)t->ctx;
+  unsigned long sum = 0;
+  int i;
+
+  pthread_setspecific(c->key, t);
+  BENCH_START();
+  for (i = 0; i < CALLS; i++)
+    {
+      switch (c->method)
+        {
+        case GET:
+          sum += (unsigned long)pthread_getspecific(c->key);
+          break;
+        case SET:
+          pthread_setspecific(c->key, (void *)(unsigned long)i);
+          break;
+        default:
+          pthread_testcancel();
+          break;
+        }
+    }
+  ATOMIC_FETCH_ADD(&c->sum, (long)sum, ATOMIC_RELAXED);      // Keeps the reads
+  return NULL;
+}
+
+
+int main(void)
+{
+  static bench_thread_t threads[3];
+  static ctx_t c;
+  SceUInt64 usec;
+  int n;
+
+  if (pthread_key_create(&c.key, NULL) != 0)
+    return 1;
+
+  for (c.method = GET; c.method <= TESTCANCEL; c.method++)
+    for (n = 1; n <= 3; n += 2)
+      {
+        usec = bench_run(n, worker, threads, &c, 0);
+        // The calls of one thread, so that ns/op is the cost of a call
+        bench_report(names[c.method], n, CALLS, usec);
+      }
+
+  pthread_key_delete(c.key);
+  return 0;
+}
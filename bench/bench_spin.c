@@ -0,0 +1,83 @@
+//Sony Computer Entertainment Confidential
+#include "bench/bench.h"
+
+/*
+ * Throughput of the test and set spin lock under contention, against
+ * a naive lock spinning on the atomic exchange itself.  Every failed
+ * exchange of the naive lock takes the cache line exclusive, and the
+ * number of those per acquisition is reported as a measure of the
+ * line traffic; the library lock reads the line until it is free, and
+ * backs off or waits for an event between attempts.
+ */
+
+#define DURATION        1000000         // Microseconds per measure
+
+typedef struct
+{
+  int                  naive;
+  volatile long        lock;            // Naive lock
+  pthread_spinlock_t   spin;
+  volatile unsigned long counter;       // Protected by the lock
+  char                 pad[PTHREAD_CACHELINE_SIZE_];
+  volatile long        attempts;        // Exchanges of the naive lock
+} ctx_t;
+
+
+static void *worker(void *arg)
+{
+  bench_thread_t *t = (bench_thread_t *)arg;
+  ctx_t *c = (ctx_t *)t->ctx;
+  long attempts = 0;
+
+  BENCH_START();
+  while (BENCH_RUNNING())
+    {
+      if (c->naive)
+        {
+          do
+            attempts++;
+          while (ATOMIC_SWAP(&c->lock, 1, ATOMIC_ACQUIRE) != 0);
+          c->counter++;
+          ATOMIC_STORE(&c->lock, 0, ATOMIC_RELEASE);
+        }
+      else
+        {
+          pthread_spin_lock(&c->spin);
+          c->counter++;
+          pthread_spin_unlock(&c->spin);
+        }
+      t->ops++;
+    }
+  ATOMIC_FETCH_ADD(&c->attempts, attempts, ATOMIC_RELAXED);
+  return NULL;
+}
+
+
+int main(void)
+{
+  static bench_thread_t threads[8];
+  static ctx_t c;
+  unsigned long ops;
+  SceUInt64 usec;
+  int n;
+
+  pthread_spin_init(&c.spin, PTHREAD_PROCESS_PRIVATE);
+
+  for (n = 1; n <= 4; n++)
+    for (c.naive = 1; c.naive >= 0; c.naive--)
+      {
+        c.counter = 0;
+        c.attempts = 0;
+        usec = bench_run(n, worker, threads, &c, DURATION);
+        ops = bench_ops(threads, n);
+        bench_report(c.naive ? "naive exchange" : "pthread_spin_lock", n, ops, usec);
+        if (c.naive && ops != 0)
+          printf("%-32s %3d threads  %lu.%02lu exclusive attempts per lock\n", "naive exchange", n,
+                 (unsigned long)c.attempts / ops, (unsigned long)c.attempts * 100 / ops % 100);
+        if (c.counter != ops)
+          printf("lost updates: %lu of %lu\n", ops - c.counter, ops);
+      }
+
+  pthread_spin_destroy(&c.spin);
+  return 0;
+}
@@ -0,0 +1,71 @@
+//Sony Computer Entertainment Confidential
+#include "bench/bench.h"
+
+/*
+ * Throughput and fairness of the three spin lock types under
+ * contention.  The fairness is the ratio of the acquisitions of the
+ * least served thread to the ones of the most served: 100% when every
+ * thread gets the lock as often, near 0 when one core keeps winning.
+ */
+
+#define DURATION        1000000         // Microseconds per measure
+#define HOLD            50              // Loop iterations inside the lock
+
+static const char *names[] = { "test and set", "ticket", "MCS" };
+
+typedef struct
+{
+  pthread_spinlock_t     spin;
+  volatile unsigned long counter;
+} ctx_t;
+
+
+static void *worker(void *arg)
+{
+  bench_thread_t *t = (bench_thread_t *)arg;
+  ctx_t *c = (ctx_t *)t->ctx;
+  int i;
+
+  BENCH_START();
+  while (BENCH_RUNNING())
+    {
+      pthread_spin_lock(&c->spin);
+      for (i = 0; i < HOLD; i++)
+        c->counter++;
+      pthread_spin_unlock(&c->spin);
+      t->ops++;
+    }
+  return NULL;
+}
+
+
+int main(void)
+{
+  static bench_thread_t threads[8];
+  static ctx_t c;
+  unsigned long lo, hi;
+  SceUInt64 usec;
+  int type, n, i;
+
+  for (type = PTHREAD_SPINLOCK_TAS_NP; type <= PTHREAD_SPINLOCK_MCS_NP; type++)
+    for (n = 2; n <= 4; n++)
+      {
+        pthread_spin_init_np(&c.spin, type);
+        usec = bench_run(n, worker, threads, &c, DURATION);
+        pthread_spin_destroy(&c.spin);
+
+        lo = hi = threads[0].ops;
+        for (i = 1; i < n; i++)
+          {
+            if (threads[i].ops < lo)
+              lo = threads[i].ops;
+            if (threads[i].ops > hi)
+              hi = threads[i].ops;
+          }
+        bench_report(names[type], n, bench_ops(threads, n), usec);
+        if (hi != 0)
+          printf("%-32s %3d threads  fairness %lu%% (min %lu, max %lu)\n",
+                 names[type], n, lo * 100 / hi, lo, hi);
+      }
+  return 0;
+}
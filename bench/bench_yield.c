@@ -0,0 +1,71 @@
+//Sony Computer Entertainment Confidential
+#include "bench/bench.h"
+
+/*
+ * Cost of sched_yield and pthread_yield_to_np.  Alone on its core, a
+ * yield is a kernel call finding nothing else to run.  With two
+ * threads of the same priority pinned to one core, every yield is a
+ * switch to the other thread, so the cost per call is the cost of a
+ * thread switch.
+ */
+
+#define CALLS           100000
+
+enum { YIELD, YIELD_TO };
+
+typedef struct
+{
+  int         method;
+  int         pinned;
+  pthread_t   peers[2];
+} ctx_t;
+
+
+static void *worker(void *arg)
+{
+  bench_thread_t *t = (bench_thread_t *)arg;
+  ctx_t *c = (ctx_t *)t->ctx;
+  int i;
+
+  // Set either way: the kernel thread may be a cached one, still pinned
+  sceKernelChangeThreadCpuAffinityMask(sceKernelGetThreadId(),
+                                       c->pinned ? SCE_KERNEL_CPU_MASK_USER_0 : SCE_KERNEL_CPU_MASK_USER_ALL);
+  c->peers[t->index] = pthread_self();
+
+  BENCH_START();
+  for (i = 0; i < CALLS; i++)
+    {
+      if (c->method == YIELD_TO)
+        pthread_yield_to_np(c->peers[t->index ^ 1]);
+      else
+        sched_yield();
+      t->ops++;
+    }
+  return NULL;
+}
+
+
+int main(void)
+{
+  static bench_thread_t threads[2];
+  ctx_t c;
+  SceUInt64 usec;
+
+  c.pinned = 0;
+  c.method = YIELD;
+  usec = bench_run(1, worker, threads, &c, 0);
+  bench_report("sched_yield, alone", 1, bench_ops(threads, 1), usec);
+
+  c.pinned = 1;
+  usec = bench_run(2, worker, threads, &c, 0);
+  bench_report("sched_yield, same core", 2, bench_ops(threads, 2), usec);
+
+  c.method = YIELD_TO;
+  usec = bench_run(2, worker, threads, &c, 0);
+  bench_report("pthread_yield_to_np, same core", 2, bench_ops(threads, 2), usec);
+
+  c.pinned = 0;
+  usec = bench_run(2, worker, threads, &c, 0);
+  bench_report("pthread_yield_to_np, any core", 2, bench_ops(threads, 2), usec);
+  return 0;
+}
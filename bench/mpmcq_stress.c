@@ -0,0 +1,118 @@
+//Sony Computer Entertainment Confidential
+#include "bench/bench.h"
+#include <string.h> // memset
+
+/*
+ * Correctness stress test of the MPMC queue.  The producers push
+ * elements made of their index and a sequence number, through a small
+ * queue so that it is full or empty most of the time, mixing the try
+ * and the blocking functions.  Every element must be popped exactly
+ * once, and a consumer must see the elements of a producer in the
+ * order they were pushed.  Returns non zero on failure.
+ */
+
+#define PER_PRODUCER    200000
+#define QUEUE_SIZE      4
+#define MAX_PRODUCERS   8
+
+#define ELEMENT(p, seq) ((void *)(((unsigned long)(p) << 24) | (seq)))
+#define PRODUCER(e)     ((unsigned long)(e) >> 24)
+#define SEQ(e)          ((unsigned long)(e) & 0xffffff)
+
+typedef struct
+{
+  int              producers;
+  int              consumers;
+  pthread_mpmcq_t  q;
+  volatile long    seen[MAX_PRODUCERS][(PER_PRODUCER + 1 + 31) / 32];
+  volatile long    errors;
+} ctx_t;
+
+
+static void *worker(void *arg)
+{
+  bench_thread_t *t = (bench_thread_t *)arg;
+  ctx_t *c = (ctx_t *)t->ctx;
+  unsigned long last[MAX_PRODUCERS];
+  unsigned long i, n, p, seq;
+  long bit;
+  void *e;
+
+  BENCH_START();
+  if (t->index < c->producers)
+    {
+      for (seq = 1; seq <= PER_PRODUCER; seq++)
+        {
+          e = ELEMENT(t->index, seq);
+          if ((seq & 1) == 0 || pthread_mpmcq_trypush_np(&c->q, e) != 0)
+            pthread_mpmcq_push_np(&c->q, e);
+        }
+      t->ops = PER_PRODUCER;
+      return NULL;
+    }
+
+  // The consumers share the pops, the last one takes the remainder
+  n = (unsigned long)c->producers * PER_PRODUCER / c->consumers;
+  if (t->index == c->producers + c->consumers - 1)
+    n = (unsigned long)c->producers * PER_PRODUCER - n * (c->consumers - 1);
+  memset(last, 0, sizeof(last));
+  for (i = 0; i < n; i++)
+    {
+      if ((i & 1) != 0 || pthread_mpmcq_trypop_np(&c->q, &e) != 0)
+        pthread_mpmcq_pop_np(&c->q, &e);
+
+      p = PRODUCER(e);
+      seq = SEQ(e);
+      if (p >= (unsigned long)c->producers || seq == 0 || seq > PER_PRODUCER || seq <= last[p])
+        {
+          ATOMIC_FETCH_ADD(&c->errors, 1, ATOMIC_RELAXED);
+          continue;
+        }
+      last[p] = seq;
+      bit = 1L << (seq & 31);
+      if (ATOMIC_FETCH_OR(&c->seen[p][seq / 32], bit, ATOMIC_RELAXED) & bit)
+        ATOMIC_FETCH_ADD(&c->errors, 1, ATOMIC_RELAXED);         // Popped twice
+    }
+  t->ops = n;
+  return NULL;
+}
+
+
+int main(void)
+{
+  static const int counts[] = { 1, 2, 3, 8 };
+  static bench_thread_t threads[2 * MAX_PRODUCERS];
+  static ctx_t c;
+  unsigned long seq, missing;
+  int p, k, i, failed = 0;
+
+  for (p = 0; p < 4; p++)
+    for (k = 0; k < 4; k++)
+      {
+        c.producers = counts[p];
+        c.consumers = counts[k];
+        c.errors = 0;
+        memset((void *)c.seen, 0, sizeof(c.seen));
+        pthread_mpmcq_init_np(&c.q, QUEUE_SIZE);
+
+        if (bench_run(c.producers + c.consumers, worker, threads, &c, 0) == 0)
+          {
+            failed = 1;
+            continue;
+          }
+
+        missing = 0;
+        for (i = 0; i < c.producers; i++)
+          for (seq = 1; seq <= PER_PRODUCER; seq++)
+            if ((c.seen[i][seq / 32] & (1L << (seq & 31))) == 0)
+              missing++;
+
+        printf("%dP/%dC: %s (%ld out of order or duplicate, %lu missing)\n",
+               c.producers, c.consumers, c.errors == 0 && missing == 0 ? "PASS" : "FAIL",
+               (long)c.errors, missing);
+        if (c.errors != 0 || missing != 0)
+          failed = 1;
+        pthread_mpmcq_destroy_np(&c.q);
+      }
+  return failed;
+}
@@ -5,80 +5,308 @@
 
 #include <stdint.h>
 
-/* Atomic operations */
+/*
+ * Atomic operations
+ *
+ * Every operation takes a memory order, with the C11 meaning:
+ *
+ *   ATOMIC_RELAXED:    atomicity only, no ordering
+ *   ATOMIC_ACQUIRE:    later accesses are not moved before the operation
+ *   ATOMIC_RELEASE:    earlier accesses are not moved after the operation
+ *   ATOMIC_ACQ_REL:    both of the above
+ *   ATOMIC_SEQ_CST:    both, and a single total order of such operations
+ *
+ * The order is meant to be a constant, so that the tests on it fold
+ * away.  The read-modify-write operations return the previous value,
+ * the compare and swap ones store swap only if the previous value is
+ * compare.
+ *
+ * There are two backends: ldrex/strex with dmb fences for SNC on the
+ * ARM, and the __atomic builtins for GCC and Clang.
+ */
 
-// Lifted from sceaatomic/include/sceaatomic.h
+#if defined(__SNC__)
 
-static inline long ATOMIC_CAS(volatile long* ptr, long compare, long swap)
+#define ATOMIC_RELAXED     0
+#define ATOMIC_ACQUIRE     1
+#define ATOMIC_RELEASE     2
+#define ATOMIC_ACQ_REL     3
+#define ATOMIC_SEQ_CST     4
+
+/* Fences around an operation of the given order */
+#define ATOMIC_BEFORE_(order)	do { if ((order) >= ATOMIC_RELEASE) __builtin_dmb(); } while(0)
+#define ATOMIC_AFTER_(order)	do { if ((order) != ATOMIC_RELAXED && (order) != ATOMIC_RELEASE) __builtin_dmb(); } while(0)
+
+/* Completion barrier (dsb), needed before CPU_SEND_EVENT */
+#define SYNC_BARRIER()		__builtin_dsb()
+
+/*
+ * Event support: CPU_WAIT_EVENT parks the core until another core
+ * executes CPU_SEND_EVENT (or an interrupt comes), instead of keeping
+ * the bus busy with polling.  CPU_RELAX is a hint for busy loops.
+ */
+#define CPU_WAIT_EVENT()	__builtin_wfe()
+#define CPU_SEND_EVENT()	__builtin_sev()
+#define CPU_RELAX()			__builtin_yield()
+
+static inline void ATOMIC_FENCE(int order)
 {
-    int32_t old;
-    do
-    {
-        old = __ldrex((volatile int*)ptr);
-        if ( old != compare )
-            break;
-    } while ( 0 != __strex((unsigned int)swap, (volatile int*)ptr) );
+    if (order != ATOMIC_RELAXED)
+        __builtin_dmb();
+}
+
+static inline long ATOMIC_LOAD(const volatile long *ptr, int order)
+{
+    long value;
+    if (order == ATOMIC_SEQ_CST)
+        __builtin_dmb();
+    value = *ptr;
+    ATOMIC_AFTER_(order);
+    return value;
+}
+
+static inline void ATOMIC_STORE(volatile long *ptr, long value, int order)
+{
+    ATOMIC_BEFORE_(order);
+    *ptr = value;
+    if (order == ATOMIC_SEQ_CST)
+        __builtin_dmb();
+}
+
+static inline long ATOMIC_SWAP(volatile long *ptr, long value, int order)
+{
+    long old;
+    ATOMIC_BEFORE_(order);
+    do {
+        old = __ldrex((volatile int *)ptr);
+    } while (__strex((unsigned int)value, (volatile int *)ptr) != 0);
+    ATOMIC_AFTER_(order);
     return old;
 }
 
-#define ATOMIC_LOAD_NULLIFY_PTR(addr)	((void *)ATOMIC_LW_SW((volatile long *)(addr), (long)NULL))
+static inline long ATOMIC_FETCH_ADD(volatile long *ptr, long value, int order)
+{
+    long old;
+    ATOMIC_BEFORE_(order);
+    do {
+        old = __ldrex((volatile int *)ptr);
+    } while (__strex((unsigned int)(old + value), (volatile int *)ptr) != 0);
+    ATOMIC_AFTER_(order);
+    return old;
+}
 
-static inline long ATOMIC_LW_SW(volatile long *addr, long value)
+static inline long ATOMIC_FETCH_OR(volatile long *ptr, long value, int order)
 {
-    long t1, t2 = *addr;
+    long old;
+    ATOMIC_BEFORE_(order);
     do {
-        t1 = t2;
-        t2 = ATOMIC_CAS(addr, t1, value);
-    } while (t1 != t2);
-    return t1;
+        old = __ldrex((volatile int *)ptr);
+    } while (__strex((unsigned int)(old | value), (volatile int *)ptr) != 0);
+    ATOMIC_AFTER_(order);
+    return old;
 }
 
+static inline long ATOMIC_FETCH_AND(volatile long *ptr, long value, int order)
+{
+    long old;
+    ATOMIC_BEFORE_(order);
+    do {
+        old = __ldrex((volatile int *)ptr);
+    } while (__strex((unsigned int)(old & value), (volatile int *)ptr) != 0);
+    ATOMIC_AFTER_(order);
+    return old;
+}
 
-static inline long ATOMIC_ADD(long *addr, long value)
+static inline long ATOMIC_CAS_EXPLICIT(volatile long *ptr, long compare, long swap, int order)
 {
-    long t1, t2 = *addr;
+    long old;
+    ATOMIC_BEFORE_(order);
     do {
-        t1 = t2;
-        t2 = ATOMIC_CAS((long *)addr, t1, t1+value);
-    } while (t1 != t2);
-    return t1 + value;
+        old = __ldrex((volatile int *)ptr);
+        if (old != compare)
+            break;
+    } while (__strex((unsigned int)swap, (volatile int *)ptr) != 0);
+    ATOMIC_AFTER_(order);
+    return old;
 }
 
+/* 64 bit compare and swap, typically for {pointer, tag} pairs */
+static inline int64_t ATOMIC_CAS64(volatile int64_t *ptr, int64_t compare, int64_t swap, int order)
+{
+    int64_t old;
+    ATOMIC_BEFORE_(order);
+    do {
+        old = (int64_t)__ldrexd((volatile unsigned long long *)ptr);
+        if (old != compare)
+            break;
+    } while (__strexd((unsigned long long)swap, (volatile unsigned long long *)ptr) != 0);
+    ATOMIC_AFTER_(order);
+    return old;
+}
 
-static inline long ATOMIC_EXCHANGE_ADD(long *addr, long value)
+/* 64 bit load: plain ldrd is not single-copy atomic */
+static inline int64_t ATOMIC_LOAD64(volatile int64_t *ptr, int order)
 {
-    long t1, t2 = *addr;
+    int64_t value;
+    if (order == ATOMIC_SEQ_CST)
+        __builtin_dmb();
     do {
-        t1 = t2;
-        t2 = ATOMIC_CAS((long *)addr, t1, t1+value);
-    } while (t1 != t2);
-    return t1;
+        value = (int64_t)__ldrexd((volatile unsigned long long *)ptr);
+    } while (__strexd((unsigned long long)value, (volatile unsigned long long *)ptr) != 0);
+    ATOMIC_AFTER_(order);
+    return value;
+}
+
+#else /* GCC, Clang */
+
+#define ATOMIC_RELAXED     __ATOMIC_RELAXED
+#define ATOMIC_ACQUIRE     __ATOMIC_ACQUIRE
+#define ATOMIC_RELEASE     __ATOMIC_RELEASE
+#define ATOMIC_ACQ_REL     __ATOMIC_ACQ_REL
+#define ATOMIC_SEQ_CST     __ATOMIC_SEQ_CST
+
+/* Order of a failed compare and swap, which is only a load */
+#define ATOMIC_FAILURE_(order) \
+	((order) == ATOMIC_RELEASE ? ATOMIC_RELAXED : (order) == ATOMIC_ACQ_REL ? ATOMIC_ACQUIRE : (order))
+
+#define SYNC_BARRIER()		__atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#if defined(__arm__) || defined(__aarch64__)
+# define CPU_WAIT_EVENT()	__asm__ __volatile__("wfe" ::: "memory")
+# define CPU_SEND_EVENT()	__asm__ __volatile__("sev" ::: "memory")
+# define CPU_RELAX()		__asm__ __volatile__("yield" ::: "memory")
+#elif defined(__i386__) || defined(__x86_64__)
+# define CPU_WAIT_EVENT()	__builtin_ia32_pause()
+# define CPU_SEND_EVENT()	do { } while(0)
+# define CPU_RELAX()		__builtin_ia32_pause()
+#else
+# define CPU_WAIT_EVENT()	do { } while(0)
+# define CPU_SEND_EVENT()	do { } while(0)
+# define CPU_RELAX()		do { } while(0)
+#endif
+
+static inline void ATOMIC_FENCE(int order)
+{
+    __atomic_thread_fence(order);
+}
+
+static inline long ATOMIC_LOAD(const volatile long *ptr, int order)
+{
+    return __atomic_load_n(ptr, order);
+}
+
+static inline void ATOMIC_STORE(volatile long *ptr, long value, int order)
+{
+    __atomic_store_n(ptr, value, order);
+}
+
+static inline long ATOMIC_SWAP(volatile long *ptr, long value, int order)
+{
+    return __atomic_exchange_n(ptr, value, order);
+}
+
+static inline long ATOMIC_FETCH_ADD(volatile long *ptr, long value, int order)
+{
+    return __atomic_fetch_add(ptr, value, order);
+}
+
+static inline long ATOMIC_FETCH_OR(volatile long *ptr, long value, int order)
+{
+    return __atomic_fetch_or(ptr, value, order);
+}
+
+static inline long ATOMIC_FETCH_AND(volatile long *ptr, long value, int order)
+{
+    return __atomic_fetch_and(ptr, value, order);
+}
+
+static inline long ATOMIC_CAS_EXPLICIT(volatile long *ptr, long compare, long swap, int order)
+{
+    __atomic_compare_exchange_n(ptr, &compare, swap, 0, order, ATOMIC_FAILURE_(order));
+    return compare;
+}
+
+static inline int64_t ATOMIC_CAS64(volatile int64_t *ptr, int64_t compare, int64_t swap, int order)
+{
+    __atomic_compare_exchange_n(ptr, &compare, swap, 0, order, ATOMIC_FAILURE_(order));
+    return compare;
+}
+
+static inline int64_t ATOMIC_LOAD64(volatile int64_t *ptr, int order)
+{
+    return __atomic_load_n(ptr, order);
+}
+
+#if defined(__LP64__)
+/* 128 bit compare and swap, for the {pointer, tag} pairs of LP64 */
+static inline unsigned __int128 ATOMIC_CAS128(volatile unsigned __int128 *ptr, unsigned __int128 compare, unsigned __int128 swap, int order)
+{
+    __atomic_compare_exchange_n(ptr, &compare, swap, 0, order, ATOMIC_FAILURE_(order));
+    return compare;
+}
+
+static inline unsigned __int128 ATOMIC_LOAD128(volatile unsigned __int128 *ptr, int order)
+{
+    return __atomic_load_n(ptr, order);
 }
+#endif
+
+#endif
+
+/* Pointer flavours */
+
+#define ATOMIC_LOAD_PTR(ptr, order) \
+	((void *)ATOMIC_LOAD((const volatile long *)(ptr), (order)))
+#define ATOMIC_STORE_PTR(ptr, value, order) \
+	ATOMIC_STORE((volatile long *)(ptr), (long)(value), (order))
+#define ATOMIC_SWAP_PTR(ptr, value, order) \
+	((void *)ATOMIC_SWAP((volatile long *)(ptr), (long)(value), (order)))
+#define ATOMIC_CAS_PTR(ptr, compare, swap, order) \
+	((void *)ATOMIC_CAS_EXPLICIT((volatile long *)(ptr), (long)(compare), (long)(swap), (order)))
 
-/* Bit support */
+/*
+ * Former interface, kept for existing code.  These operations are
+ * relaxed except MEMORY_BARRIER.
+ */
 
-static inline int test_and_set_bit(long nr, unsigned long *addr) 
+#define MEMORY_BARRIER()	ATOMIC_FENCE(ATOMIC_SEQ_CST)
+
+#define ATOMIC_LOAD_NULLIFY_PTR(addr)	ATOMIC_SWAP_PTR((addr), NULL, ATOMIC_RELAXED)
+
+static inline long ATOMIC_CAS(volatile long* ptr, long compare, long swap)
+{
+    return ATOMIC_CAS_EXPLICIT(ptr, compare, swap, ATOMIC_RELAXED);
+}
+
+static inline long ATOMIC_LW_SW(volatile long *addr, long value)
+{
+    return ATOMIC_SWAP(addr, value, ATOMIC_RELAXED);
+}
+
+static inline long ATOMIC_ADD(long *addr, long value)
+{
+    return ATOMIC_FETCH_ADD(addr, value, ATOMIC_RELAXED) + value;
+}
+
+static inline long ATOMIC_EXCHANGE_ADD(long *addr, long value)
+{
+    return ATOMIC_FETCH_ADD(addr, value, ATOMIC_RELAXED);
+}
+
+/* Bit support, unused by the library but kept for user code */
+
+static inline int test_and_set_bit(long nr, unsigned long *addr)
 {
     unsigned long *m = ((unsigned long *) addr) + (nr >> 5);
     unsigned long bit = (1U << (nr & 0x1F));
-    long t1, t2 = *addr;
-    do {
-        t1 = t2;
-        t2 = ATOMIC_CAS((long *)m, t1, t1|bit);
-    } while (t1 != t2);
-    return (t1 & bit) != 0;
+    return (ATOMIC_FETCH_OR((volatile long *)m, (long)bit, ATOMIC_ACQ_REL) & bit) != 0;
 }
 
-static inline int test_and_clear_bit(long nr, unsigned long *addr) 
+static inline int test_and_clear_bit(long nr, unsigned long *addr)
 {
     unsigned long *m = ((unsigned long *) addr) + (nr >> 5);
     unsigned long bit = (1U << (nr & 0x1F));
-    long t1, t2 = *addr;
-    do {
-        t1 = t2;
-        t2 = ATOMIC_CAS((long *)m, t1, t1^bit);
-    } while (t1 != t2);
-    return (t1 & bit) != 0;
+    return (ATOMIC_FETCH_AND((volatile long *)m, (long)~bit, ATOMIC_ACQ_REL) & bit) != 0;
 }
 
 
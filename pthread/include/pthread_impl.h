@@ -42,6 +42,9 @@ EXTERN void PCHECK_(const char *file, int line, int rc);
 // Number of per-thread keys that we support
 #define PTHREAD_KEYS_MAX_     48
 
+// L1/L2 cache line size of the Cortex-A9
+#define PTHREAD_CACHELINE_SIZE_   32
+
 
 /* Declaration of a control to be put inside a pthread struct   */
 #define CONTROL   SceUID control
@@ -54,43 +57,189 @@ typedef struct pthread_cleanup_t
 } pthread_cleanup_t;
 
 
-typedef struct pthread_storage_t
+/* Queue node of an MCS spin lock waiter, alone on its cache line */
+#define PTHREAD_MCS_NODES_        4     // Per thread: MCS locks held or waited for at once
+
+typedef struct pthread_mcs_node_t
+{
+  struct pthread_mcs_node_t * volatile next;    // Next waiter
+  volatile long                        locked;  // Cleared by the predecessor on release
+  int                                  index;   // In the owner's mcs_used mask
+  char                                 pad[PTHREAD_CACHELINE_SIZE_ - 2 * sizeof(void *) - sizeof(int)];
+} pthread_mcs_node_t;
+
+
+/*
+ * Lock free LIFO: the head packs the pointer to the top node in its low
+ * half and a modification count in its high half, updated together by
+ * a compare and swap of the whole head: 64 bits, or 128 bits on LP64,
+ * where the head is 16 byte aligned as its type.
+ */
+typedef struct pthread_lifo_node_t
+{
+  struct pthread_lifo_node_t *next;
+} pthread_lifo_node_t;
+
+#if defined(__LP64__)
+typedef unsigned __int128 pthread_lifo_head_t;
+#else
+typedef int64_t pthread_lifo_head_t;
+#endif
+
+typedef struct pthread_lifo_t
+{
+  volatile pthread_lifo_head_t head;
+} pthread_lifo_t;
+
+#define PTHREAD_LIFO_INITIALIZER_               { 0 }
+
+
+/* Size classes of the bundled allocator: 16 << class bytes, header included */
+#define PTHREAD_ALLOC_CLASSES_    7
+#define PTHREAD_MAGAZINE_SIZE_    16
+
+
+/*
+ * Hazard pointers: every thread owns a record holding its hazard
+ * pointers and the nodes it retired.  The records are linked in a
+ * global list and reused, never freed.
+ */
+#define PTHREAD_HAZARDS_          4     // Per thread: pointers protected at once
+
+typedef struct pthread_hazard_head_t
+{
+  struct pthread_hazard_head_t *next;
+  void                         (*func)(struct pthread_hazard_head_t *);
+  const void                   *ptr;    // Address compared with the hazard pointers
+} pthread_hazard_head_t;
+
+typedef struct pthread_hazard_rec_t
+{
+  void * volatile              hazard[PTHREAD_HAZARDS_];
+  struct pthread_hazard_rec_t *next;    // All the records, newest first
+  volatile long                active;  // Owned by a thread
+  pthread_hazard_head_t       *retired; // Waiting for a scan
+  long                         nretired;
+  int                          scanning;
+} pthread_hazard_rec_t;
+
+
+/* Node retired under epoch based reclamation */
+typedef struct pthread_ebr_head_t
+{
+  struct pthread_ebr_head_t *next;
+  void                      (*func)(struct pthread_ebr_head_t *);
+  unsigned long             epoch;      // Global epoch when retired
+} pthread_ebr_head_t;
+
+
+/* Thread data rarely used, kept out of the cache lines of the hot fields */
+typedef struct pthread_storage_cold_t
 {
-  CONTROL;                              // Lock control
-  SceUID                id;             // sceID of the thread
   SceUID                condCBID;       // Callback for support of cond variables
   SceUID                barrierCBID;    // Callback for support of barriers
   SceUID                joinCBID;       // Callback for support of join
-  pthread_cleanup_t    *cleanup;
-  volatile long         cancel_state;
-  volatile long         cancel_type;
   int                   waiting;        // Number of threads waiting to join this thread
-  unsigned long         detached;
   void                 *returncode;     // Thread return code
+  char                  joinable;
+  char                  needsfree;      // Thread storage belongs to pthread lib and will be freed with PTHREAD_FREE
+  char                  pooled;         // Thread storage is recycled through the storage pool, never freed
+  void                 *base;           // Allocation holding the storage when needsfree, aligned in it on a cache line
   char                  name[SCE_UID_NAMELEN+1];
+
+  /* 
+     The priomutex array indicates how many mutex of each priority are held 
+     by this thread.
+     We assume there will be no more than 128 mutex per priority
+     This is needed to implement priority ceiling.
+  */
+  unsigned char priomutex[128];
+
+  /* Link in the storage pool or the thread cache */
+  pthread_lifo_node_t   pool;
+
+  /* Kernel thread: stack size and attributes it was created with, and
+     while the storage is in the thread cache, the dormant thread itself
+  */
+  size_t                stacksize;
+  SceUInt               kattr;
+  SceUID                kthread;
+} pthread_storage_cold_t;
+
+
+/*
+ * The fields read on the common paths (pthread_self, the keys, the
+ * cancellation points and the locks) come first and fill the first two
+ * cache lines, the rarely used ones are grouped in cold at the end.
+ * Every storage is aligned on a cache line for this.
+ */
+typedef struct pthread_storage_t
+{
+  /* First line: identity, keys, cancellation and lock waits */
+  CONTROL;                              // Lock control
+  SceUID                id;             // sceID of the thread
+  pthread_cleanup_t    *cleanup;
+  volatile long         cancel_state;
+  volatile long         cancel_type;
+  volatile long         detached;
+  int                   specific_data_count;
   char                  cancel_pending;
-  char                  joinable;
   char                  inWAIT;         // Indicates the thread is waiting for a pthread mutex or cond
   char                  terminated;     // Thread is terminated
-  char                  needsfree;      // Thread storage belongs to pthread lib and will be freed with PTHREAD_FREE
 
   /* Original priority of the thread.  The thread priority can be temporarily
      changed when waiting on mutex.
   */
   unsigned char priority;
 
-  /* 
-     The priomutex array indicates how many mutex of each priority are held 
-     by this thread.
-     We assume there will be no more than 128 mutex per priority
-     This is needed to implement priority ceiling.
+  /* Second line: state read by the reclamation schemes, and by their
+     scans of the registry of the live threads
   */
-  unsigned char priomutex[128];
-  
+  struct pthread_storage_t *next;
+  struct pthread_storage_t *prev;
+
+  /* RCU quiescent state: grace period seen on entry of the outermost
+     read-side critical section, or 0 when the thread is quiescent.
+  */
+  volatile unsigned long rcu_ctr;
+  int                   rcu_nesting;
+
+  /* Epoch based reclamation: epoch | 1 while in a critical region, else 0 */
+  volatile unsigned long ebr_state;
+  int                   ebr_nesting;
+
+  /* Hazard pointer record, claimed when the thread starts */
+  pthread_hazard_rec_t *hazard;
+
+  int                   alloc_cached;   // Set while the thread may use its magazines
+
   /* Specific data has been moved inline instead of being dynamically allocated when accessed */
-  int                   specific_data_count;
   const void           *specific_data[PTHREAD_KEYS_MAX_];
-  
+
+  /* MCS spin lock queue nodes, aligned at run time on a cache line */
+  unsigned long         mcs_used;
+  char                  mcs_mem[(PTHREAD_MCS_NODES_ + 1) * PTHREAD_CACHELINE_SIZE_];
+
+  /* Nodes retired under epoch based reclamation, newest first */
+  pthread_ebr_head_t   *ebr_limbo;
+  long                  ebr_count;
+
+  /* Allocator cache: loaded and previous magazine of every size class */
+  struct pthread_magazine_t *magazines[PTHREAD_ALLOC_CLASSES_][2];
+
+  /* Bump arena: free space of the current chunk, the chunks newest
+     first, and a chunk kept for reuse
+  */
+  char                 *arena_top;
+  char                 *arena_end;
+  struct pthread_arena_chunk_t *arena;
+  struct pthread_arena_chunk_t *arena_spare;
+
+  /* Object pool caches, most recently used first */
+  struct pthread_pool_cache_t *pool_caches;
+
+  pthread_storage_cold_t cold;
+
 #ifdef __cplusplus
   /* Helper operators for C++ */
   PTHREAD_CPP_OPERATORS(pthread_storage_t, id)
@@ -100,10 +249,18 @@ typedef struct pthread_storage_t
 } pthread_storage_t;
 typedef pthread_storage_t* pthread_t;
 
+typedef struct pthread_rcu_head_t
+{
+  struct pthread_rcu_head_t *next;
+  void                      (*func)(struct pthread_rcu_head_t *);
+} pthread_rcu_head_t;
+
+
 typedef struct pthread_attr_t
 {
   int joinable;
   size_t stacksize;
+  void *stackaddr;              // Stack supplied by the caller, or NULL
   int priority;
   SceUInt attr;
   char name[SCE_UID_NAMELEN - 9 + 1];
@@ -113,17 +270,60 @@ typedef struct pthread_attr_t
 
 typedef struct pthread_barrierattr_t
 {
+  int type;                     // PTHREAD_BARRIER_*_NP
+  int fanin;                    // Tree barriers only
 } pthread_barrierattr_t;
 
 
-typedef struct pthread_barrier_t
+/* Node of a tree barrier, alone on its cache line */
+typedef struct pthread_barrier_node_t
 {
-  CONTROL;
-  SceUID        queue;
-  long          neededcount;
-  long          count;
+  volatile long           state;          // Phase tag << 16 | arrivals
+  long                    capacity;       // Arrivals completing the node
+  long                    parent;         // Index of the parent node, -1 for the root
+  volatile unsigned long  phase;          // Next phase, once the node is released
+  char                    pad[PTHREAD_CACHELINE_SIZE_ - 4 * sizeof(long)];
+} pthread_barrier_node_t;
+
+
+/* Returned by pthread_barrier_arrive_np, redeemed by pthread_barrier_wait_token_np */
+#define PTHREAD_BARRIER_MAX_DEPTH_   32
 
-  PTHREAD_CPP_OPERATORS(pthread_barrier_t,control)
+typedef struct pthread_barrier_token_t
+{
+  unsigned long phase;          // Phase arrived at
+  int           serial;         // Non zero if the phase was completed on arrival
+  int           depth;          // Tree barriers: number of nodes won
+  long          node;           // Tree barriers: node where the arrival stopped, -1 for a split arrival
+  long          path[PTHREAD_BARRIER_MAX_DEPTH_];   // Tree barriers: nodes won
+} pthread_barrier_token_t;
+
+
+/* Value contributed to a barrier reduction */
+typedef union pthread_barrier_value_t
+{
+  long  l;
+  float f;
+} pthread_barrier_value_t;
+
+
+typedef struct pthread_barrier_t
+{
+  SceUID                  queue[2];       // Parking semaphores, indexed by sense
+  long                    neededcount;
+  volatile long           count;          // Arrivals in the current phase
+  volatile unsigned long  phase;          // Bumped on release, low bit is the sense
+  volatile long           sleepers[2];    // Threads parked on queue[]
+  int                     type;           // PTHREAD_BARRIER_*_NP
+  long                    leaves;         // Tree barriers: nodes[0..leaves-1] are the leaves
+  volatile long           orphans[2];     // Tree barriers: nodes won by split arrivals, indexed by sense
+  pthread_barrier_node_t *nodes;
+  void                   *mem;            // Allocation holding the nodes
+  volatile long           tickets;        // Reductions: contributions in the current phase
+  pthread_barrier_value_t *slots;         // Reductions: one per contribution
+  pthread_barrier_value_t result[2];      // Reductions: indexed by sense
+
+  PTHREAD_CPP_OPERATORS(pthread_barrier_t,queue[0])
 } pthread_barrier_t;
 
 
@@ -200,11 +400,174 @@ typedef struct pthread_rwlockattr_t
 
 typedef struct pthread_spinlock_t
 {
-  unsigned long lock;
+  volatile unsigned long lock;                  // Test and set: 0 or 1
+  int                    type;                  // PTHREAD_SPINLOCK_*_NP
+  volatile unsigned long next;                  // Ticket: next ticket to hand out
+  volatile unsigned long serving;               // Ticket: ticket of the owner
+  pthread_mcs_node_t * volatile tail;           // MCS: last waiter
+  pthread_mcs_node_t    *holder;                // MCS: node of the owner
 } pthread_spinlock_t;
 
 #define PTHREAD_SPINLOCK_INITIALIZER_           { 0 }
 
+typedef struct pthread_locktable_t
+{
+  SceKernelLwMutexWork *stripes;        // One lock per cache line
+  void                 *mem;            // Allocation holding the stripes
+  unsigned int          shift;          // 32 - log2(number of stripes)
+} pthread_locktable_t;
+
+
+/*
+ * Parking place for the threads of the lock free primitives, see
+ * pthread_waitq.c.
+ */
+typedef struct pthread_waitq_t
+{
+  SceUID                  sema;
+  volatile long           waiters;        // Registered and not yet woken up
+} pthread_waitq_t;
+
+
+/* Cell of a MPMC queue */
+typedef struct pthread_mpmcq_cell_t
+{
+  volatile unsigned long  seq;            // Position the cell is ready for
+  void                   *data;
+} pthread_mpmcq_cell_t;
+
+typedef struct pthread_mpmcq_t
+{
+  pthread_mpmcq_cell_t   *cells;
+  unsigned long           mask;           // Number of cells - 1
+  pthread_waitq_t         notempty;       // Blocked pops
+  pthread_waitq_t         notfull;        // Blocked pushes
+  char                    pad0[PTHREAD_CACHELINE_SIZE_];
+  volatile unsigned long  enqueue;        // Next position to push
+  char                    pad1[PTHREAD_CACHELINE_SIZE_];
+  volatile unsigned long  dequeue;        // Next position to pop
+  char                    pad2[PTHREAD_CACHELINE_SIZE_];
+} pthread_mpmcq_t;
+
+
+/* Magazine of the bundled allocator: a stack of free blocks of one size class */
+typedef struct pthread_magazine_t
+{
+  pthread_lifo_node_t     node;           // In the depot
+  int                     count;
+  void                   *rounds[PTHREAD_MAGAZINE_SIZE_];
+} pthread_magazine_t;
+
+
+/* Allocator installed with pthread_set_allocator_np */
+typedef struct pthread_allocator_t
+{
+  void                   *(*alloc)(void *ctx, size_t size);
+  void                    (*free)(void *ctx, void *ptr);
+  void                   *ctx;
+} pthread_allocator_t;
+
+
+/* Chunk of a bump arena, followed by its memory */
+typedef struct pthread_arena_chunk_t
+{
+  struct pthread_arena_chunk_t *next;   // Older chunk
+  size_t                        size;   // Usable bytes
+} pthread_arena_chunk_t;
+
+/* Position in the arena of a thread, to release back to */
+typedef struct pthread_arena_mark_t
+{
+  pthread_arena_chunk_t  *chunk;
+  char                   *top;
+} pthread_arena_mark_t;
+
+/* Allocations handed off by an arena to another thread */
+typedef struct pthread_arena_t
+{
+  pthread_arena_chunk_t  *chunks;
+} pthread_arena_t;
+
+
+/* Per-thread cache of an object pool, in the list of its thread */
+typedef struct pthread_pool_cache_t
+{
+  struct pthread_pool_cache_t *next;    // All the caches of the pool
+  struct pthread_pool_cache_t *link;    // Next cache of the same thread
+  volatile long           active;       // Owned by a thread
+  struct pthread_pool_t  *pool;         // NULL once the pool is destroyed
+  pthread_magazine_t     *mags[2];      // Loaded and previous magazine
+} pthread_pool_cache_t;
+
+/* Pool of fixed size objects */
+typedef struct pthread_pool_t
+{
+  size_t                  size;         // Of an object, 0 once destroyed
+  unsigned int            slab;         // Objects allocated at a time
+  pthread_pool_cache_t * volatile caches;
+  pthread_lifo_t          full;         // Depot: full magazines
+  pthread_lifo_t          empty;        // Depot: empty magazines
+  pthread_lifo_t          objects;      // Free objects out of any magazine
+  pthread_lifo_t          slabs;
+} pthread_pool_t;
+
+
+/* Zero copy SPSC ring */
+typedef struct pthread_spscring_t
+{
+  char                   *buffer;
+  unsigned long           size;
+  pthread_waitq_t         notempty;       // Blocked consumer
+  pthread_waitq_t         notfull;        // Blocked producer
+  char                    pad0[PTHREAD_CACHELINE_SIZE_];
+  /* Producer side */
+  volatile unsigned long  write;          // End of the committed data
+  volatile unsigned long  watermark;      // End of the data before a wrap
+  unsigned long           reserved;       // Start of the reserved region
+  unsigned long           reservedlen;
+  char                    pad1[PTHREAD_CACHELINE_SIZE_];
+  /* Consumer side */
+  volatile unsigned long  read;           // Start of the data
+  unsigned long           peekedlen;      // Left to release of the last peek
+  char                    pad2[PTHREAD_CACHELINE_SIZE_];
+} pthread_spscring_t;
+
+
+/*
+ * Concurrent hash map: chained buckets read without lock, updated under
+ * the stripe of the key.  While the map grows the old table links to
+ * the new one, into which its buckets are migrated one at a time.
+ */
+typedef struct pthread_hashmap_node_t
+{
+  pthread_ebr_head_t                        ebr;    // First, for the reclamation
+  struct pthread_hashmap_node_t * volatile  next;
+  unsigned long                             hash;
+  const void                               *key;
+  void                                     *value;
+} pthread_hashmap_node_t;
+
+typedef struct pthread_hashmap_table_t
+{
+  pthread_ebr_head_t                        ebr;    // First, for the reclamation
+  pthread_hashmap_node_t * volatile        *buckets;
+  unsigned long                             mask;   // Number of buckets - 1
+  struct pthread_hashmap_table_t * volatile next;   // Table being migrated to
+  volatile long                             migrate;    // Next bucket to migrate
+  volatile long                             migrated;   // Buckets migrated
+} pthread_hashmap_table_t;
+
+typedef struct pthread_hashmap_t
+{
+  pthread_hashmap_table_t * volatile        table;  // Oldest table
+  SceKernelLwMutexWork                     *stripes;  // Writer locks, one per cache line
+  void                                     *mem;   // Allocation holding the stripes
+  unsigned long                             (*hash)(const void *key);
+  int                                       (*equal)(const void *a, const void *b);
+  volatile long                             count;
+} pthread_hashmap_t;
+
+
 typedef struct pthread_mbx_t
 {
   SceUID id;
@@ -263,8 +626,8 @@ typedef struct pthread_once_t
 /* -----------------------------
      malloc/free
    ----------------------------- */
-# define PTHREAD_MALLOC(size)       malloc(size) 
-# define PTHREAD_FREE(ptr)          do { free((void*)(ptr)); (ptr) = NULL; } while(0)
+# define PTHREAD_MALLOC(size)       pthread_malloc_(size) 
+# define PTHREAD_FREE(ptr)          do { pthread_free_((void*)(ptr)); (ptr) = NULL; } while(0)
 
 #define CLEAR(x)                do { memset(x, 0, sizeof(*x)); } while(0)
 
@@ -309,9 +672,8 @@ do {                                                    \
 
 #define INIT_CONTROL(c)                                 \
 do {                                                    \
-  int res_ = sceKernelCreateSema("pthread control",     \
-                                SCE_KERNEL_ATTR_TH_FIFO,   \
-                                1, 1, NULL);            \
+  int res_ = pthread_sema_get_(PTHREAD_SEMA_CONTROL_,   \
+                               NULL);                   \
   if (res_ > 0)                                         \
     c->control = res_;                                  \
   else                                                  \
@@ -320,8 +682,7 @@ do {                                                    \
 
 #define DELETE_CONTROL(c)                               \
 do {                                                    \
-  int res_ = sceKernelDeleteSema((c)->control);         \
-  sceCHECK(res_);                                       \
+  pthread_sema_put_(PTHREAD_SEMA_CONTROL_, (c)->control); \
 } while(0)
 
 
@@ -339,6 +700,9 @@ EXTERN void pthread_cleanupspecific(pthread_t me);
 
 EXTERN pthread_t pthread_get(SceUID id);
 
+/* Head of the live thread registry, protected by ENTER_CRITICAL */
+extern pthread_t pthread_list_;
+
 /**
  * The EXECUTE_ONCE_* mechansim is different from the ONCE_INIT 
  * mechanism in pthread.  First it can be used before pthread is
@@ -354,22 +718,22 @@ EXTERN pthread_t pthread_get(SceUID id);
 static volatile long control = 0;        	\
 {                                       	\
   int s;                                	\
-  if (control == 2)                     	\
+  if (ATOMIC_LOAD(&control, ATOMIC_ACQUIRE) == 2)  \
     goto _execute_once_done_;           	\
                                         	\
-  if ((s = ATOMIC_LW_SW(&control, 1)) == 2) {   \
-      control = 2;                      	\
+  if ((s = ATOMIC_SWAP(&control, 1, ATOMIC_ACQ_REL)) == 2) { \
+      ATOMIC_STORE(&control, 2, ATOMIC_RELEASE);  \
       goto _execute_once_done_;            	\
   }                                             \
   else if (s == 1) {                     	\
-      while (s != 2)                    	\
+      while (ATOMIC_LOAD(&control, ATOMIC_ACQUIRE) != 2) \
         sceKernelDelayThread(1);        	\
       goto _execute_once_done_;            	\
   }                                             \
 }
 
 #define EXECUTE_ONCE_END()              	\
-  control = 2;                          	\
+  ATOMIC_STORE(&control, 2, ATOMIC_RELEASE);	\
   _execute_once_done_: ;                	\
 
 
@@ -419,6 +783,31 @@ static inline void TRACE(void *p, SceUID s, const char *msg)
 
 EXTERN void pthread_init_();
 EXTERN void pthread_cleanupspecific_(pthread_t me);
+EXTERN int  pthread_hazard_acquire_(pthread_t th);
+EXTERN void pthread_hazard_release_(pthread_t th);
+EXTERN void pthread_ebr_release_(pthread_t th);
+EXTERN pthread_t pthread_current_(void);
+EXTERN void *pthread_malloc_(size_t size);
+EXTERN void pthread_free_(void *ptr);
+EXTERN void pthread_alloc_release_(pthread_t th);
+EXTERN void pthread_arena_release_(pthread_t th);
+EXTERN void pthread_pool_release_(pthread_t th);
+
+/* Kinds of the pooled semaphores: binary controls, and counting wait
+   semaphores starting at 0 */
+#define PTHREAD_SEMA_CONTROL_     0
+#define PTHREAD_SEMA_WAIT_        1
+#define PTHREAD_SEMA_KINDS_       2
+
+EXTERN SceUID pthread_sema_get_(int kind, const char *name);
+EXTERN void pthread_sema_put_(int kind, SceUID id);
+
+EXTERN int  pthread_waitq_init_(pthread_waitq_t *q, const char *name);
+EXTERN void pthread_waitq_destroy_(pthread_waitq_t *q);
+EXTERN void pthread_waitq_prepare_(pthread_waitq_t *q);
+EXTERN void pthread_waitq_cancel_(pthread_waitq_t *q);
+EXTERN int  pthread_waitq_wait_(pthread_waitq_t *q, SceUInt *timeout);
+EXTERN void pthread_waitq_wake_(pthread_waitq_t *q);
 
 /*
  * timespec should be defined in <time.h> but appears to be 
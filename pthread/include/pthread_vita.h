@@ -25,6 +25,18 @@
  *      Mailbox support (_np) 
  *      Event flags (_np) 
  *      Message pipe (_np)
+ *      Read-Copy-Update (_np)
+ *      Lock tables (_np)
+ *      MPMC queues (_np)
+ *      SPSC rings (_np)
+ *      Lock free LIFOs (_np)
+ *      Hazard pointers (_np)
+ *      Epoch based reclamation (_np)
+ *      Hash maps (_np)
+ *      Allocator (_np)
+ *      Semaphore pool (_np)
+ *      Arenas (_np)
+ *      Object pools (_np)
  *      Other Non-Portable functions (_np) 
  *      Unimplemented functions 
  *      Additional functions that are not part of pthread but 
@@ -172,6 +184,7 @@ typedef void (*pthread_callback_t)(SceUID threadId);
 #define PTHREAD_RECURSIVE_MUTEX_INITIALIZER     PTHREAD_RECURSIVE_MUTEX_INITIALIZER_
 #define PTHREAD_SPINLOCK_INITIALIZER            PTHREAD_SPINLOCK_INITIALIZER_
 #define PTHREAD_ERRORCHECK_MUTEX_INITIALIZER    PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_
+#define PTHREAD_LIFO_INITIALIZER_NP             PTHREAD_LIFO_INITIALIZER_
 
 /** @} */
 
@@ -423,6 +436,23 @@ EXTERN int pthread_attr_getstacksize(const pthread_attr_t *restrict attr,
                                      size_t *restrict stacksize);
 
 
+/** 
+ * The functions pthread_attr_setstack() and pthread_attr_getstack(),
+ * respectively, set and get the thread creation stack attributes in
+ * the attr object: the lowest address and the size of the storage
+ * the created thread uses as its stack.  The size must be at least
+ * PTHREAD_STACK_MIN.
+ * The kernel thread itself keeps a stack of PTHREAD_STACK_MIN bytes,
+ * on which the thread starts before switching to the supplied one.
+ * Returns ENOTSUP on the targets where the switch is not supported.
+ */
+
+EXTERN int pthread_attr_setstack(pthread_attr_t *attr, void *stackaddr, size_t stacksize);
+
+EXTERN int pthread_attr_getstack(const pthread_attr_t *restrict attr, 
+                                 void **restrict stackaddr, size_t *restrict stacksize);
+
+
 /**
  * The functions pthread_attr_setstorage_np() and
  * pthread_attr_getstorage_np(), respectively, set and
@@ -431,7 +461,12 @@ EXTERN int pthread_attr_getstacksize(const pthread_attr_t *restrict attr,
  *
  * The storage which is passed and returned should be a
  * pointer to a struct pthread_storage_t which will last
- * for the lifetime of the thread.
+ * for the lifetime of the thread.  It should be aligned on a
+ * cache line (32 bytes): the fields used on every lock, key
+ * access and cancellation point then share one line, and the
+ * per-thread state read by the other threads another.  A
+ * storage not aligned works too, but costs an extra cache
+ * line on these paths.
  */
 
 EXTERN int pthread_attr_setstorage_np(pthread_attr_t *attr, pthread_storage_t *storage);
@@ -779,9 +814,78 @@ EXTERN int pthread_barrier_init(pthread_barrier_t *restrict barrier,
 EXTERN int pthread_barrier_destroy(pthread_barrier_t *barrier);
 EXTERN int pthread_barrier_wait(pthread_barrier_t *barrier);
 
+/**
+ * Split phase wait.  pthread_barrier_arrive_np records the arrival of
+ * the calling thread and returns immediately with a token, which must
+ * then be passed to pthread_barrier_wait_token_np by the same thread
+ * before it arrives at the barrier again.  Between the two calls, the
+ * thread can do work that does not depend on the phase completing.
+ *
+ * pthread_barrier_arrive_np returns 0 or EINVAL, and
+ * pthread_barrier_wait_token_np returns the same values as
+ * pthread_barrier_wait.
+ */
+
+EXTERN int pthread_barrier_arrive_np(pthread_barrier_t *barrier, 
+                                     pthread_barrier_token_t *token);
+EXTERN int pthread_barrier_wait_token_np(pthread_barrier_t *barrier, 
+                                         pthread_barrier_token_t *token);
+
+/**
+ * Wait on the barrier and reduce the values contributed by the threads
+ * of the phase with op.  The reduction is computed by the last thread
+ * to arrive, before the others are released, and every thread returns
+ * with the result.  All the threads of a phase must use the same op
+ * and the same function; the bitwise operators are not available with
+ * floats.
+ *
+ * Returns 0 or PTHREAD_BARRIER_SERIAL_THREAD like pthread_barrier_wait,
+ * or EINVAL.
+ */
+
+enum {
+  PTHREAD_REDUCE_SUM_NP,
+  PTHREAD_REDUCE_MIN_NP,
+  PTHREAD_REDUCE_MAX_NP,
+  PTHREAD_REDUCE_AND_NP,
+  PTHREAD_REDUCE_OR_NP,
+  PTHREAD_REDUCE_XOR_NP,
+};
+
+EXTERN int pthread_barrier_wait_reduce_np(pthread_barrier_t *barrier, 
+                                          int op, long value, long *result);
+EXTERN int pthread_barrier_wait_reducef_np(pthread_barrier_t *barrier, 
+                                           int op, float value, float *result);
+
 EXTERN int pthread_barrierattr_destroy(pthread_barrierattr_t *barrierattr);
 EXTERN int pthread_barrierattr_init(pthread_barrierattr_t *barrierattr);
 
+/**
+ * Set and get the barrier type.
+ *
+ * A central barrier (the default) counts the arrivals on a single
+ * counter, which is the fastest with a few threads.  A tree barrier
+ * combines the arrivals up a tree of nodes, each completed by at most
+ * fanin threads, and releases the threads back down the tree.  No
+ * location is then shared by more than fanin + 1 threads, so the cost
+ * of a phase grows with the depth of the tree instead of the number
+ * of threads.
+ *
+ * The fan-in is between 2 and 8, the default is 4.
+ *
+ * The set and get functions return 0 or EINVAL.
+ */
+
+enum {
+  PTHREAD_BARRIER_CENTRAL_NP,
+  PTHREAD_BARRIER_TREE_NP,
+};
+
+EXTERN int pthread_barrierattr_gettype_np(const pthread_barrierattr_t *barrierattr, int *type);
+EXTERN int pthread_barrierattr_settype_np(pthread_barrierattr_t *barrierattr, int type);
+EXTERN int pthread_barrierattr_getfanin_np(const pthread_barrierattr_t *barrierattr, int *fanin);
+EXTERN int pthread_barrierattr_setfanin_np(pthread_barrierattr_t *barrierattr, int fanin);
+
 /** @} */
 
 
@@ -1150,6 +1254,23 @@ EXTERN int pthread_mutexattr_getqueueingpolicy_np(const pthread_mutexattr_t *att
 EXTERN int pthread_mutexattr_setqueueingpolicy_np(pthread_mutexattr_t *attr, 
                                                   int policy);
 
+
+/**
+ * Lock or unlock the n mutexes of the array as a group.
+ *
+ * pthread_mutex_lock_many_np never deadlocks against another thread
+ * locking an overlapping set of mutexes, whatever the order of the
+ * arrays.  It returns 0 with every mutex locked, or an error with none
+ * of them locked.  A non recursive mutex listed twice, or already owned
+ * by the caller, returns EDEADLK.
+ *
+ * pthread_mutex_unlock_many_np unlocks in reverse array order, and
+ * returns 0 or the last error reported by pthread_mutex_unlock.
+ */
+
+EXTERN int pthread_mutex_lock_many_np(pthread_mutex_t * const *mutexes, int n);
+EXTERN int pthread_mutex_unlock_many_np(pthread_mutex_t * const *mutexes, int n);
+
 /** @} */
 
 
@@ -1299,6 +1420,30 @@ EXTERN int pthread_spin_lock(pthread_spinlock_t *lock);
 EXTERN int pthread_spin_trylock(pthread_spinlock_t *lock);
 EXTERN int pthread_spin_unlock(pthread_spinlock_t *lock);
 
+/**
+ * Initialize a spin lock of the given type:
+ *
+ *   PTHREAD_SPINLOCK_TAS_NP:     test and set, the default.  Cheapest
+ *                                uncontended, but not fair.
+ *   PTHREAD_SPINLOCK_TICKET_NP:  the lock is granted in arrival order.
+ *   PTHREAD_SPINLOCK_MCS_NP:     granted in arrival order, and each
+ *                                waiter spins on its own cache line.
+ *                                A thread can hold or wait for at most
+ *                                4 MCS locks at once, further locks
+ *                                return EAGAIN.  The lock must be
+ *                                unlocked by the thread which locked it.
+ *
+ * Returns 0 or EINVAL.
+ */
+
+enum {
+  PTHREAD_SPINLOCK_TAS_NP,
+  PTHREAD_SPINLOCK_TICKET_NP,
+  PTHREAD_SPINLOCK_MCS_NP,
+};
+
+EXTERN int pthread_spin_init_np(pthread_spinlock_t *lock, int type);
+
 /** @} */
 
 
@@ -1474,6 +1619,633 @@ EXTERN int pthread_msgpipeattr_destroy_np(pthread_msgpipeattr_t *attr);
 /** @} */
 
 
+/* ******************************************** */
+/* ********** Read-Copy-Update (_np) ********** */
+/* ******************************************** */
+
+/** @defgroup Rcu Read-Copy-Update
+ *
+ * @{
+ */
+
+/*
+ * RCU is meant for data that is read constantly and replaced rarely.
+ * Readers do not take any lock: they only mark the boundaries of their
+ * read-side critical sections in their own thread record.  Writers
+ * publish a new version of the data with pthread_rcu_assign_pointer_np()
+ * and may only free the old version after a grace period, that is once
+ * every thread which could still see it has left its critical section.
+ *
+ * Read-side critical sections can be nested but must not block
+ * indefinitely, and pthread_synchronize_rcu_np() must not be called
+ * from inside one.
+ */
+
+EXTERN void pthread_rcu_read_lock_np(void);
+EXTERN void pthread_rcu_read_unlock_np(void);
+
+/**
+ * Publish the pointer v into p.  The initialization of the pointed
+ * data is made visible before the pointer itself.
+ */
+#define pthread_rcu_assign_pointer_np(p, v) \
+	do { ATOMIC_FENCE(ATOMIC_RELEASE); (p) = (v); } while(0)
+
+/**
+ * Read a pointer published with pthread_rcu_assign_pointer_np().
+ * Must be called from inside a read-side critical section.
+ */
+#define pthread_rcu_dereference_np(p)   (*(volatile __typeof__(p) *)&(p))
+
+/**
+ * Wait until all the read-side critical sections in progress when
+ * the call was made have completed.
+ */
+EXTERN void pthread_synchronize_rcu_np(void);
+
+/**
+ * Schedule func(head) to be called after a grace period, typically to
+ * free the structure head is embedded in.  The callbacks are run in
+ * batches by a background thread, which is started on first use.
+ *
+ * Returns 0, EINVAL or EAGAIN if the background thread could not be
+ * created.
+ */
+EXTERN int pthread_call_rcu_np(pthread_rcu_head_t *head,
+                               void (*func)(pthread_rcu_head_t *));
+
+/** @} */
+
+
+/* *************************************** */
+/* ********** Lock tables (_np) ********** */
+/* *************************************** */
+
+/** @defgroup LockTable Lock tables
+ *
+ * @{
+ */
+
+/*
+ * A lock table protects an unbounded number of objects with a fixed
+ * number of locks (stripes), the object address selecting the stripe.
+ * This gives per-object locking without a mutex embedded in, or
+ * allocated for, every object.  Each stripe sits on its own cache line.
+ *
+ * The stripes are recursive, so locking two objects that hash to the
+ * same stripe from one thread does not deadlock; they must however be
+ * unlocked as many times as they were locked.
+ */
+
+/** Number of stripes used when 0 is passed to pthread_locktable_init_np() */
+#define PTHREAD_LOCKTABLE_DEFAULT_NP   256
+
+/**
+ * Initialize table with count stripes, rounded up to a power of two
+ * (at most 65536).
+ *
+ * Returns 0, EINVAL or ENOMEM.
+ */
+EXTERN int pthread_locktable_init_np(pthread_locktable_t *table, unsigned int count);
+EXTERN int pthread_locktable_destroy_np(pthread_locktable_t *table);
+
+EXTERN int pthread_locktable_lock_np(pthread_locktable_t *table, const void *addr);
+EXTERN int pthread_locktable_trylock_np(pthread_locktable_t *table, const void *addr);
+EXTERN int pthread_locktable_unlock_np(pthread_locktable_t *table, const void *addr);
+
+/**
+ * Lock the stripes covering the n addresses in addrs.  The stripes are
+ * taken in a global order, so concurrent callers cannot deadlock, and
+ * a stripe shared by several addresses is only locked once.
+ */
+EXTERN int pthread_locktable_lock_many_np(pthread_locktable_t *table,
+                                          const void * const *addrs, int n);
+EXTERN int pthread_locktable_unlock_many_np(pthread_locktable_t *table,
+                                            const void * const *addrs, int n);
+
+/** @} */
+
+
+/* *************************************** */
+/* ********** MPMC queues (_np) ********** */
+/* *************************************** */
+
+/** @defgroup Mpmcq MPMC Queues
+ *
+ * @{
+ */
+
+/*
+ * Bounded lock free queue of pointers, for any number of producers
+ * and consumers.  The try functions never block and return EAGAIN when
+ * the queue is full (push) or empty (pop).  The blocking functions
+ * wait in the kernel only in that case; a push or pop only makes a
+ * kernel call when a thread is blocked on the other side.
+ *
+ * The elements are popped in the order of their push, and a push
+ * returns once its element is visible to the consumers.
+ */
+
+/**
+ * Initialize q with room for size elements, rounded up to a power of
+ * two.
+ *
+ * Returns 0, EINVAL, ENOMEM or EAGAIN.
+ */
+EXTERN int pthread_mpmcq_init_np(pthread_mpmcq_t *q, unsigned int size);
+EXTERN int pthread_mpmcq_destroy_np(pthread_mpmcq_t *q);
+
+EXTERN int pthread_mpmcq_trypush_np(pthread_mpmcq_t *q, void *data);
+EXTERN int pthread_mpmcq_trypop_np(pthread_mpmcq_t *q, void **data);
+EXTERN int pthread_mpmcq_push_np(pthread_mpmcq_t *q, void *data);
+EXTERN int pthread_mpmcq_pop_np(pthread_mpmcq_t *q, void **data);
+
+/** @} */
+
+
+/* ************************************** */
+/* ********** SPSC rings (_np) ********** */
+/* ************************************** */
+
+/** @defgroup Spscring SPSC Rings
+ *
+ * @{
+ */
+
+/*
+ * Byte ring between exactly one producer and one consumer thread, with
+ * no copy: the producer reserves a contiguous region of the ring,
+ * writes into it in place and commits what it wrote; the consumer
+ * peeks at the oldest contiguous block of committed data, reads it in
+ * place and releases what it read.  One reservation (one peek) can be
+ * outstanding at a time.  Committing more than was reserved, or
+ * releasing more than was peeked, returns EINVAL.
+ *
+ * The try functions return EAGAIN when there is not enough contiguous
+ * room (no data).  The blocking functions park the caller in that case,
+ * and the peer only makes a kernel call to wake up a parked thread.
+ * A blocking reservation must not exceed half the size of the ring.
+ */
+
+/**
+ * Initialize ring with a buffer of size bytes.
+ *
+ * Returns 0, EINVAL, ENOMEM or EAGAIN.
+ */
+EXTERN int pthread_spscring_init_np(pthread_spscring_t *ring, unsigned int size);
+EXTERN int pthread_spscring_destroy_np(pthread_spscring_t *ring);
+
+/* Producer */
+EXTERN int pthread_spscring_tryreserve_np(pthread_spscring_t *ring, unsigned int len, void **ptr);
+EXTERN int pthread_spscring_reserve_np(pthread_spscring_t *ring, unsigned int len, void **ptr);
+EXTERN int pthread_spscring_commit_np(pthread_spscring_t *ring, unsigned int len);
+
+/* Consumer */
+EXTERN int pthread_spscring_trypeek_np(pthread_spscring_t *ring, void **ptr, unsigned int *len);
+EXTERN int pthread_spscring_peek_np(pthread_spscring_t *ring, void **ptr, unsigned int *len);
+EXTERN int pthread_spscring_release_np(pthread_spscring_t *ring, unsigned int len);
+
+/** @} */
+
+
+/* ******************************************* */
+/* ********** Lock free LIFOs (_np) ********** */
+/* ******************************************* */
+
+/** @defgroup Lifo Lock free LIFOs
+ *
+ * @{
+ */
+
+/*
+ * Intrusive lock free stack (Treiber stack), typically for free lists:
+ * the nodes are embedded in the user objects.  The head carries a
+ * modification count next to the top pointer, so that a node popped
+ * and pushed back while another thread was popping cannot corrupt the
+ * stack (ABA problem).
+ *
+ * A pop reads the next field of a node that may be popped concurrently
+ * by another thread, so the memory of the nodes must stay readable
+ * while the stack is in use, which is the case with pools.
+ */
+
+EXTERN int pthread_lifo_init_np(pthread_lifo_t *lifo);
+
+EXTERN void pthread_lifo_push_np(pthread_lifo_t *lifo, pthread_lifo_node_t *node);
+
+/**
+ * Push the chain of nodes linked from first to last through their next
+ * field, in one operation.  first ends up on top.
+ */
+EXTERN void pthread_lifo_push_chain_np(pthread_lifo_t *lifo, 
+                                       pthread_lifo_node_t *first,
+                                       pthread_lifo_node_t *last);
+
+/**
+ * Pop the top node, or return NULL if the stack is empty.
+ */
+EXTERN pthread_lifo_node_t *pthread_lifo_pop_np(pthread_lifo_t *lifo);
+
+/**
+ * Empty the stack in one operation.  Returns the former top node, the
+ * others are linked from it, or NULL if the stack was empty.
+ */
+EXTERN pthread_lifo_node_t *pthread_lifo_pop_all_np(pthread_lifo_t *lifo);
+
+/** @} */
+
+
+/* ******************************************* */
+/* ********** Hazard pointers (_np) ********** */
+/* ******************************************* */
+
+/** @defgroup Hazard Hazard pointers
+ *
+ * @{
+ */
+
+/*
+ * Hazard pointers make it safe to free the nodes of a lock free
+ * structure while other threads may still be reading them.  A reader
+ * loads a shared pointer with pthread_hazard_protect_np(), which keeps
+ * the node it points to alive until the slot is cleared or reused.  A
+ * writer which unlinked a node hands it to pthread_hazard_retire_np()
+ * instead of freeing it, and the node is freed by a later scan once no
+ * thread protects it any more.
+ *
+ * Every pthread gets its hazard record when it starts, and gives it
+ * back when it is detached; the nodes it retired and that could not be
+ * freed yet are then adopted by the other threads.
+ */
+
+/** Number of hazard pointers per thread */
+#define PTHREAD_HAZARD_SLOTS_NP        PTHREAD_HAZARDS_
+
+/**
+ * Load the pointer at src into *ptr and protect it in the hazard
+ * pointer slot of the calling thread.  The node stays protected until
+ * the slot is cleared or used again.
+ *
+ * Returns 0, EINVAL or ENOMEM.
+ */
+EXTERN int pthread_hazard_protect_np(int slot, void * volatile *src, void **ptr);
+EXTERN int pthread_hazard_clear_np(int slot);
+
+/**
+ * Retire the node at ptr, which must no longer be reachable from the
+ * shared structure: func(head) is called once no hazard pointer
+ * protects ptr, typically to free the node head is embedded in.
+ *
+ * Returns 0, EINVAL or ENOMEM.
+ */
+EXTERN int pthread_hazard_retire_np(pthread_hazard_head_t *head, const void *ptr,
+                                    void (*func)(pthread_hazard_head_t *));
+
+/**
+ * Free right away the nodes retired by the calling thread that are not
+ * protected.  Scans otherwise happen when enough nodes were retired.
+ */
+EXTERN int pthread_hazard_scan_np(void);
+
+/** @} */
+
+
+/* *************************************************** */
+/* ********** Epoch based reclamation (_np) ********** */
+/* *************************************************** */
+
+/** @defgroup Ebr Epoch based reclamation
+ *
+ * @{
+ */
+
+/*
+ * Epoch based reclamation serves the same purpose as hazard pointers
+ * at a lower cost for the readers: instead of protecting every pointer
+ * they load, they only mark the boundaries of their critical regions.
+ * A node retired with pthread_ebr_retire_np() is freed once every
+ * thread that was inside a critical region at the time has left it.
+ *
+ * The retired nodes are freed in batches, by the thread which retired
+ * them.  A thread staying inside a critical region holds back the
+ * reclamation of all the threads, so critical regions must be short
+ * and must not block.  They can be nested.
+ */
+
+EXTERN void pthread_ebr_enter_np(void);
+EXTERN void pthread_ebr_exit_np(void);
+
+/**
+ * Retire the node head is embedded in, which must no longer be
+ * reachable from the shared structure: func(head) is called once no
+ * critical region can still reference it.
+ *
+ * Returns 0 or EINVAL.
+ */
+EXTERN int pthread_ebr_retire_np(pthread_ebr_head_t *head,
+                                 void (*func)(pthread_ebr_head_t *));
+
+/**
+ * Free the nodes retired by the calling thread that are safe, without
+ * waiting for the next batch.  Called outside of any critical region,
+ * this frees all of them unless another thread is inside one.
+ */
+EXTERN int pthread_ebr_reclaim_np(void);
+
+/** @} */
+
+
+/* ************************************* */
+/* ********** Hash maps (_np) ********** */
+/* ************************************* */
+
+/** @defgroup Hashmap Hash maps
+ *
+ * @{
+ */
+
+/*
+ * Concurrent hash map from keys to values, both opaque pointers; the
+ * map does not copy the keys, which must stay valid while they are in
+ * the map.  Lookups take no lock.  Insertions and removals lock one of
+ * the stripes of the map, selected by the hash of the key, so updates
+ * of different keys mostly proceed in parallel.
+ *
+ * The map doubles its number of buckets when it holds more elements
+ * than buckets.  The buckets are then migrated a few at a time by the
+ * following updates, the lookups searching both tables meanwhile, so
+ * no operation ever waits for a whole resize.
+ *
+ * Removed elements are reclaimed with epoch based reclamation (see
+ * above), so the calling threads must not stay inside a critical region
+ * of their own while they update a map.
+ */
+
+/**
+ * Initialize map with size buckets, rounded up to a power of two (at
+ * least 64).  hash and equal apply to the keys; when NULL, the keys are
+ * hashed and compared as integers.
+ *
+ * Returns 0, EINVAL, ENOMEM or EAGAIN.
+ */
+EXTERN int pthread_hashmap_init_np(pthread_hashmap_t *map, unsigned int size,
+                                   unsigned long (*hash)(const void *key),
+                                   int (*equal)(const void *a, const void *b));
+EXTERN int pthread_hashmap_destroy_np(pthread_hashmap_t *map);
+
+/**
+ * Returns 0 and the value of key in *value, ENOENT or EINVAL.
+ */
+EXTERN int pthread_hashmap_lookup_np(pthread_hashmap_t *map, const void *key, void **value);
+
+/**
+ * Returns 0, EEXIST if key is in the map already, ENOMEM or EINVAL.
+ */
+EXTERN int pthread_hashmap_insert_np(pthread_hashmap_t *map, const void *key, void *value);
+
+/**
+ * Returns 0 and the value key had in *value (unless value is NULL),
+ * ENOENT or EINVAL.
+ */
+EXTERN int pthread_hashmap_remove_np(pthread_hashmap_t *map, const void *key, void **value);
+
+/**
+ * Number of elements, which is only a snapshot while the map is updated.
+ */
+EXTERN unsigned long pthread_hashmap_count_np(pthread_hashmap_t *map);
+
+#ifdef __cplusplus
+/**
+ * Typed C++ interface: K is converted to and from the key pointer, so it
+ * can be a pointer or an integer type; the values are pointers to V.
+ */
+template <class K, class V>
+class pthread_hashmap_np
+{
+public:
+  explicit pthread_hashmap_np(unsigned int size = 0,
+                              unsigned long (*hash)(const void *key) = 0,
+                              int (*equal)(const void *a, const void *b) = 0)
+    { status_ = pthread_hashmap_init_np(&map_, size, hash, equal); }
+  ~pthread_hashmap_np()
+    { if (status_ == 0) pthread_hashmap_destroy_np(&map_); }
+
+  /* Result of the initialization */
+  int status() const                    { return status_; }
+
+  int lookup(K key, V **value)          { return pthread_hashmap_lookup_np(&map_, (const void *)key, (void **)value); }
+  int insert(K key, V *value)           { return pthread_hashmap_insert_np(&map_, (const void *)key, (void *)value); }
+  int remove(K key, V **value = 0)      { return pthread_hashmap_remove_np(&map_, (const void *)key, (void **)value); }
+  unsigned long count()                 { return pthread_hashmap_count_np(&map_); }
+
+private:
+  pthread_hashmap_np(const pthread_hashmap_np &);
+  pthread_hashmap_np &operator= (const pthread_hashmap_np &);
+
+  pthread_hashmap_t map_;
+  int status_;
+};
+#endif
+
+/** @} */
+
+
+/* ************************************* */
+/* ********** Allocator (_np) ********** */
+/* ************************************* */
+
+/** @defgroup Allocator Allocator
+ *
+ * @{
+ */
+
+/*
+ * The library allocates its memory (thread storage, queues, tables...)
+ * through a bundled allocator, which keeps per-thread caches of the
+ * small blocks so that these allocations take no global heap lock in
+ * the common case.  The larger blocks, and the memory of the caches,
+ * come from malloc.
+ *
+ * pthread_set_allocator_np() installs another allocator instead: alloc
+ * must return memory aligned on 8 bytes, or NULL, and free must accept
+ * any pointer returned by alloc.  Both are called with ctx as first
+ * argument, from any thread.
+ */
+
+/**
+ * Install a, or the bundled allocator if a is NULL, for the next
+ * allocations of the library.  Every block is freed by the allocator
+ * which allocated it, so this can be called at any time, from any
+ * thread.  The library keeps a copy of every distinct allocator
+ * installed, for the blocks still allocated from it.
+ *
+ * Returns 0, EINVAL or ENOMEM.
+ */
+EXTERN int pthread_set_allocator_np(const pthread_allocator_t *a);
+
+/**
+ * Return the installed allocator in *a, with NULL functions for the
+ * bundled one.
+ */
+EXTERN int pthread_get_allocator_np(pthread_allocator_t *a);
+
+/** @} */
+
+
+/* ****************************************** */
+/* ********** Semaphore pool (_np) ********** */
+/* ****************************************** */
+
+/** @defgroup Semapool Semaphore pool
+ *
+ * @{
+ */
+
+/*
+ * Every thread, cond, barrier and most of the _np objects need kernel
+ * semaphores, created when the object is initialized.  Once the pool is
+ * on, these come from semaphores created ahead of time by a background
+ * thread, and the ones of the destroyed objects are reused, so that
+ * initializing an object makes no kernel object creation in the common
+ * case.
+ *
+ * The kernel callbacks used by pthread_cond_wait are bound to the thread
+ * which creates them, and cannot be pooled.  Every thread creates its
+ * callback on its first wait, and a thread restarted from the thread
+ * cache keeps the callback of its kernel thread.
+ */
+
+/**
+ * Turn the semaphore pool on: the pool of every kind of semaphore is
+ * refilled up to highmark once it falls to lowmark.  The refill runs in
+ * a detached thread of low priority.
+ *
+ * Returns 0, EINVAL if lowmark is not below highmark, or highmark is 0
+ * or above 4096, EBUSY if the pool is on already, ENOMEM or EAGAIN.
+ */
+EXTERN int pthread_set_semapool_np(unsigned int lowmark, unsigned int highmark);
+
+/** @} */
+
+
+/* ********************************** */
+/* ********** Arenas (_np) ********** */
+/* ********************************** */
+
+/** @defgroup Arenas Arenas
+ *
+ * @{
+ */
+
+/*
+ * Every thread owns a bump arena for temporary allocations that die
+ * together, typically those of a job.  An allocation only moves a
+ * pointer of the calling thread, without lock or atomic operation.
+ * Nothing is freed individually: pthread_arena_release_np() releases
+ * everything allocated since a mark, and pthread_arena_reset_np()
+ * everything.  The arena of a thread is freed when it exits.
+ *
+ *   pthread_arena_mark_t m;
+ *
+ *   pthread_arena_mark_np(&m);
+ *   tmp = pthread_arena_alloc_np(n);
+ *   ...
+ *   pthread_arena_release_np(&m);
+ *
+ * The arena functions only apply to the arena of the calling thread.
+ * pthread_arena_handoff_np() lets allocations outlive the job, for
+ * instance for its results to be read by another thread.
+ */
+
+/**
+ * Allocate size bytes, aligned on 8 bytes, in the arena of the calling
+ * thread, 8 bytes for a size of 0.  Returns NULL when out of memory.
+ */
+EXTERN void *pthread_arena_alloc_np(size_t size);
+
+/**
+ * Store the current position of the arena of the calling thread in
+ * *mark.
+ */
+EXTERN int pthread_arena_mark_np(pthread_arena_mark_t *mark);
+
+/**
+ * Release everything allocated in the arena of the calling thread
+ * since *mark was taken.  The marks taken after *mark become invalid.
+ *
+ * Returns 0, or EINVAL if *mark is not a valid mark of the arena, in
+ * which case nothing is released.
+ */
+EXTERN int pthread_arena_release_np(const pthread_arena_mark_t *mark);
+
+/**
+ * Release everything allocated in the arena of the calling thread.
+ */
+EXTERN int pthread_arena_reset_np(void);
+
+/**
+ * Hand everything allocated so far in the arena of the calling thread
+ * off to *arena, and empty the arena.  The allocations stay valid until
+ * pthread_arena_free_np() is called on *arena, from any thread.  The
+ * marks of the arena become invalid.
+ */
+EXTERN int pthread_arena_handoff_np(pthread_arena_t *arena);
+
+/**
+ * Free the allocations handed off to *arena.
+ */
+EXTERN int pthread_arena_free_np(pthread_arena_t *arena);
+
+/** @} */
+
+
+/* **************************************** */
+/* ********** Object pools (_np) ********** */
+/* **************************************** */
+
+/** @defgroup Pools Object pools
+ *
+ * @{
+ */
+
+/*
+ * Pool of objects of a fixed size.  Every thread caches free objects
+ * of the pool, so that allocating and freeing take no lock nor atomic
+ * operation in the common case, and exchanges them with the other
+ * threads by batches.  An object may be freed by any thread.
+ *
+ * The cache of a thread is given back to the pool when the thread
+ * exits.  The threads not created by the library use no cache.
+ */
+
+/**
+ * Initialize a pool of objects of size bytes, allocated slab objects
+ * at a time (a default number if slab is 0).  The objects are aligned
+ * on 8 bytes.
+ *
+ * Returns 0 or EINVAL.
+ */
+EXTERN int pthread_pool_init_np(pthread_pool_t *pool, size_t size, unsigned int slab);
+
+/**
+ * Free the pool and all its objects.  No other thread may use the pool
+ * meanwhile.
+ */
+EXTERN int pthread_pool_destroy_np(pthread_pool_t *pool);
+
+/**
+ * Allocate an object of the pool.  Returns NULL when out of memory.
+ */
+EXTERN void *pthread_pool_alloc_np(pthread_pool_t *pool);
+
+/**
+ * Give obj back to the pool.
+ */
+EXTERN int pthread_pool_free_np(pthread_pool_t *pool, void *obj);
+
+/** @} */
+
+
 /* ********************************************************* */
 /* ********** Other Non-Portable functions (*_np) ********** */
 /* ********************************************************* */
@@ -1523,6 +2295,19 @@ EXTERN int pthread_delay_until_np(const struct timespec *abstime);
 EXTERN int pthread_getthreadid_np(pthread_t thread, int *id);
 
 
+/**
+ * Give the processor to the given thread, typically the owner of a
+ * resource the caller is waiting for.  The thread runs before the
+ * caller if it is ready and may run on the core of the caller, and
+ * the caller only yields otherwise.  The priority of a thread boosted
+ * by a mutex is never changed.
+ *
+ * Return 0 (success), EINVAL or ESRCH
+ */
+
+EXTERN int pthread_yield_to_np(pthread_t thread);
+
+
 /**
  * Gets elapsed time from system operation start.
  * Always return 0 (success)
@@ -1553,12 +2338,10 @@ EXTERN int pthread_attr_getschedpolicy(const pthread_attr_t *restrict restrict,
                                        int *restrict restrict);
 EXTERN int pthread_attr_setschedpolicy(pthread_attr_t *restrict attr, int value);
 EXTERN int pthread_attr_getscope(const pthread_attr_t *restrict , int *restrict );
-EXTERN int pthread_attr_getstack(const pthread_attr_t restrict *, void restrict **, size_t restrict *);
 EXTERN int pthread_attr_getstackaddr(const pthread_attr_t *restrict, void **restrict);
 EXTERN int pthread_attr_setguardsize(pthread_attr_t *attr, size_t guardsize);
 EXTERN int pthread_attr_setinheritsched(pthread_attr_t *, int);
 EXTERN int pthread_attr_setscope(pthread_attr_t *, int);
-EXTERN int pthread_attr_setstack(pthread_attr_t *, void *, size_t);
 EXTERN int pthread_attr_setstackaddr(pthread_attr_t *, void *);
 EXTERN int pthread_barrierattr_getpshared(const pthread_barrierattr_t *barrierattr, int *barrier);
 EXTERN int pthread_barrierattr_setpshared(pthread_barrierattr_t *barrier, int value);
@@ -1,7 +1,8 @@
 //Sony Computer Entertainment Confidential
 #include "pthread/include/pthread.h"
 #include <stdarg.h>
-#include <string.h> // memset
+#include <string.h> // memset, strncmp
+#include <stddef.h> // offsetof
 #include <moduleinfo.h>
 #include <kernel/threadmgr_mono.h>	// special sony provided thread manager, downloaded using PSP2Player.pm
 
@@ -11,9 +12,52 @@ SCE_MODULE_INFO (PTHREAD_PRX, SCE_MODULE_ATTR_NONE, 1, 1);
 static pthread_callback_t pthread_add_thread_callback = NULL;
 static pthread_callback_t pthread_delete_thread_callback = NULL;
 
-static pthread_storage_t UserMainThreadStorage;
+/* The hot fields of a storage fill exactly its first two cache lines */
+typedef char pthread_storage_check_[offsetof(pthread_storage_t, next) == PTHREAD_CACHELINE_SIZE_ &&
+                                    offsetof(pthread_storage_t, specific_data) == 2 * PTHREAD_CACHELINE_SIZE_ ? 1 : -1];
+
+#define ALIGN_STORAGE(p) \
+	((pthread_t)(((unsigned long)(p) + PTHREAD_CACHELINE_SIZE_ - 1) & ~(unsigned long)(PTHREAD_CACHELINE_SIZE_ - 1)))
+
+static char UserMainThreadStorage[sizeof(pthread_storage_t) + PTHREAD_CACHELINE_SIZE_ - 1];
 static pthread_t UserMainThread = NULL;
 
+/*
+ * Storage of the calling thread, set when the thread starts, so that
+ * pthread_self is a load from thread local storage instead of two
+ * kernel calls and the parsing of the thread name.  pthread_get stays
+ * the fallback on the compilers without thread local storage.
+ */
+#if defined(__SNC__) || defined(__GNUC__)
+# define TLS_SUPPORTED_
+static __thread pthread_t tls_self = NULL;
+#endif
+
+pthread_t pthread_list_ = NULL;
+
+/* 
+ * Storages of the exited threads, ready for reuse with their control
+ * semaphore.  Up to STORAGE_POOL_MAX storages join the pool, and they
+ * are never freed, so that a pop can always read the link of a stale
+ * top.
+ *
+ * The storages whose kernel thread ended normally keep it, dormant, in
+ * the thread cache instead, bucketed by stack size: a thread created
+ * with the same stack size, attributes and name is restarted instead
+ * of having the kernel allocate a new thread and stack.  The name of
+ * the kernel thread refers to the storage (see pthread_get), which is
+ * why both are cached together.  When no cached thread matches and the
+ * pool is empty, the oldest dormant thread is deleted and its storage
+ * reused, so the cache holds at most STORAGE_POOL_MAX kernel threads
+ * and none of them for good.
+ */
+#define STORAGE_POOL_MAX   32
+#define CACHE_BUCKETS      8    // PTHREAD_STACK_MIN << bucket, the last one for all the larger stacks
+
+static pthread_lifo_t storage_pool = PTHREAD_LIFO_INITIALIZER_;
+static pthread_lifo_t thread_cache[CACHE_BUCKETS];
+static volatile long storage_pooled = 0;
+
 /* 
  * The enter/leave critical function pointers will be set after the 
  * pthread initialization is completed, othewise we could have 
@@ -50,6 +94,220 @@ static void leave_critical_func()
 }
 
 
+/*
+ * The registry links every live pthread so that other threads can
+ * inspect their per-thread state (see the RCU grace period detection).
+ */
+
+static void register_thread(pthread_t th)
+{
+  ENTER_CRITICAL();
+  th->prev = NULL;
+  th->next = pthread_list_;
+  if (pthread_list_ != NULL)
+    pthread_list_->prev = th;
+  pthread_list_ = th;
+  LEAVE_CRITICAL();
+}
+
+static void unregister_thread(pthread_t th)
+{
+  ENTER_CRITICAL();
+  if (th->prev != NULL)
+    th->prev->next = th->next;
+  else if (pthread_list_ == th)
+    pthread_list_ = th->next;
+  if (th->next != NULL)
+    th->next->prev = th->prev;
+  th->next = th->prev = NULL;
+  LEAVE_CRITICAL();
+}
+
+
+static inline pthread_t pool_storage(pthread_lifo_node_t *node)
+{
+  return (pthread_t)((char *)node - offsetof(pthread_storage_t, cold.pool));
+}
+
+
+static pthread_t pool_get(void)
+{
+  pthread_lifo_node_t *node;
+
+  node = pthread_lifo_pop_np(&storage_pool);
+  if (node == NULL)
+    return NULL;
+  return pool_storage(node);
+}
+
+
+static int cache_bucket(size_t stacksize)
+{
+  int b;
+
+  for (b = 0; b < CACHE_BUCKETS - 1; b++)
+    if (stacksize <= ((size_t)PTHREAD_STACK_MIN << b))
+      break;
+  return b;
+}
+
+
+static int same_name(pthread_t th, const pthread_attr_t *attr)
+{
+  if (attr->name[0] == 0)
+    return th->cold.name[8] == 0;
+  return th->cold.name[8] == ' ' && strncmp(&th->cold.name[9], attr->name, sizeof(attr->name)) == 0;
+}
+
+
+static int dormant(SceUID id)
+{
+  SceKernelThreadInfo info;
+
+  info.size = sizeof(SceKernelThreadInfo);
+  return sceKernelGetThreadInfo(id, &info) == SCE_OK && info.status == SCE_KERNEL_THREAD_STATUS_DORMANT;
+}
+
+
+/*
+ * Take a storage out of bucket: the first one whose dormant kernel
+ * thread matches the stack size and attr.  With attr NULL, evict the
+ * oldest one whose kernel thread is dormant instead: that thread is
+ * deleted and the storage returned without one.  Returns NULL if the
+ * bucket has no such storage.
+ *
+ * The other storages are left in the bucket: a detached thread caches
+ * itself just before it ends, so its kernel thread may not be dormant
+ * yet, and is skipped instead of waited for.
+ */
+
+static pthread_t cache_take(pthread_lifo_t *bucket, size_t stacksize, const pthread_attr_t *attr)
+{
+  pthread_lifo_node_t *list, *node, *next, *first, *last;
+  pthread_t th, found;
+  int res;
+
+  list = pthread_lifo_pop_all_np(bucket);
+  found = NULL;
+  if (attr != NULL)
+    for (node = list; node != NULL && found == NULL; node = node->next)
+      {
+        th = pool_storage(node);
+        if (th->cold.stacksize == stacksize && th->cold.kattr == attr->attr &&
+            same_name(th, attr) && dormant(th->cold.kthread))
+          found = th;
+      }
+  else
+    {
+      // The bucket is a LIFO, so the last dormant thread is the oldest
+      for (node = list; node != NULL; node = node->next)
+        {
+          th = pool_storage(node);
+          if (dormant(th->cold.kthread))
+            found = th;
+        }
+      if (found != NULL)
+        {
+          res = sceKernelDeleteThread(found->cold.kthread);
+          sceCHECK(res);
+          found->cold.kthread = INVALID_ID_;
+        }
+    }
+
+  first = last = NULL;
+  for (node = list; node != NULL; node = next)
+    {
+      next = node->next;
+      if (pool_storage(node) == found)
+        continue;
+      if (last != NULL)
+        last->next = node;
+      else
+        first = node;
+      last = node;
+    }
+  if (first != NULL)
+    pthread_lifo_push_chain_np(bucket, first, last);
+  return found;
+}
+
+
+/*
+ * Returns a storage for a new thread with the stack size and attr: one
+ * whose kernel thread can be restarted, or else one without a kernel
+ * thread, taken from the pool or evicted from the cache, or NULL.
+ */
+
+static pthread_t cache_get(size_t stacksize, const pthread_attr_t *attr)
+{
+  pthread_t th;
+  int b, i;
+
+  b = cache_bucket(stacksize);
+  if ((th = cache_take(&thread_cache[b], stacksize, attr)) != NULL)
+    return th;
+  if ((th = pool_get()) != NULL)
+    return th;
+
+  // Evict, from the same bucket first: the threads nobody asks for
+  // would otherwise keep their stack and their storage forever
+  for (i = 0; i < CACHE_BUCKETS; i++)
+    if ((th = cache_take(&thread_cache[(b + i) % CACHE_BUCKETS], 0, NULL)) != NULL)
+      return th;
+  return NULL;
+}
+
+
+/*
+ * Free a storage allocated by the library, or keep it in the pool.
+ * id is the kernel thread of the storage, if not deleted already: it
+ * is cached with the storage when possible, and deleted otherwise,
+ * unless it is the calling thread (me), which is then left dormant.
+ */
+
+static void release_storage(pthread_t th, SceUID id, int me)
+{
+  void *base;
+  int res;
+
+  // The storages allocated here join the pool while it has room
+  if (th->cold.needsfree && !th->cold.pooled)
+    {
+      if (ATOMIC_FETCH_ADD(&storage_pooled, 1, ATOMIC_RELAXED) < STORAGE_POOL_MAX)
+        th->cold.pooled = 1;
+      else
+        ATOMIC_FETCH_ADD(&storage_pooled, -1, ATOMIC_RELAXED);
+    }
+
+  if (th->cold.pooled && id != DELETED_ID_)
+    {
+      th->cold.kthread = id;
+      pthread_lifo_push_np(&thread_cache[cache_bucket(th->cold.stacksize)], &th->cold.pool);
+      return;
+    }
+
+  if (id != DELETED_ID_ && !me)
+    {
+      res = sceKernelDeleteThread(id);
+      sceCHECK(res);
+    }
+
+  if (th->cold.pooled)
+    {
+      th->cold.kthread = INVALID_ID_;
+      pthread_lifo_push_np(&storage_pool, &th->cold.pool);
+      return;
+    }
+
+  DELETE_CONTROL(th);
+  if (th->cold.needsfree)
+    {
+      base = th->cold.base;
+      PTHREAD_FREE(base);
+    }
+}
+
+
 static void cleanup(pthread_t th)
 {
   while (th->cleanup != NULL) 
@@ -72,18 +330,17 @@ static void detach(pthread_t th, int me)
   id = th->id;
   th->id = DELETED_ID_;
 
-  if (id != DELETED_ID_ && !me)
-    {
-      res = sceKernelDeleteThread(id);
-      sceCHECK(res);
-    }
   pthread_cleanupspecific_(th);
+  pthread_hazard_release_(th);
+  pthread_ebr_release_(th);
+  pthread_pool_release_(th);
+  pthread_arena_release_(th);
+  pthread_alloc_release_(th);
+  unregister_thread(th);
+  // Back to its initial count, for the next user of the storage if any
   res = sceKernelCancelSema(th->control, -1, &NumThreads);
   sceCHECK(res);
-  res = sceKernelDeleteSema(th->control);
-  sceCHECK(res);
-  if (th->needsfree)
-    PTHREAD_FREE(th);
+  release_storage(th, id, me);
 }
 
 
@@ -128,8 +385,35 @@ typedef struct
   void *(*start)(void *);
   void *param;
   pthread_t thread;
+  void *stacktop;               // Stack supplied with pthread_attr_setstack, or NULL
 } sceGlueParam_t;
 
+
+#if defined(__SNC__) || defined(__arm__)
+/*
+ * Call start(param) on the stack ending at top.  r4 is callee saved,
+ * so it keeps the kernel stack pointer across the call.  SNC, which
+ * only targets the ARM core of the Vita, takes the GNU asm syntax.
+ */
+static void *call_on_stack(void *(*start)(void *), void *param, void *top)
+{
+  void *ret;
+
+  __asm__ __volatile__(
+    "mov  r4, sp\n\t"
+    "mov  sp, %[top]\n\t"
+    "mov  r0, %[param]\n\t"
+    "blx  %[start]\n\t"
+    "mov  sp, r4\n\t"
+    "mov  %[ret], r0\n\t"
+    : [ret] "=r" (ret)
+    : [start] "r" (start), [param] "r" (param), [top] "r" (top)
+    : "r0", "r1", "r2", "r3", "r4", "r12", "lr", "cc", "memory");
+  return ret;
+}
+# define STACK_SWITCH_SUPPORTED_
+#endif
+
 EXTERN void pthread_ext_set_add_thread_callback(pthread_callback_t callback)
 {
 	pthread_add_thread_callback = callback;
@@ -151,11 +435,18 @@ static inline int sceGlue(SceSize s, void *param)
   sceGlueParam_t *p = param;
   pthread_t me = p->thread;
 
-  me->returncode = (void *)0;
+#ifdef TLS_SUPPORTED_
+  tls_self = me;
+#endif
+  me->cold.returncode = (void *)0;
   
   // Unused parameters...
   (void)&s;
 
+  // Hazard pointer record, claimed again on first use if this fails
+  pthread_hazard_acquire_(me);
+  me->alloc_cached = 1;
+
   // GC_psp2_add_thread (sceKernelGetThreadId ());
   if (pthread_add_thread_callback)
   {
@@ -163,7 +454,12 @@ static inline int sceGlue(SceSize s, void *param)
   }
 
   // Pass the control to the thread with the argument pointer
-  me->returncode = p->start(p->param);
+#ifdef STACK_SWITCH_SUPPORTED_
+  if (p->stacktop != NULL)
+    me->cold.returncode = call_on_stack(p->start, p->param, p->stacktop);
+  else
+#endif
+    me->cold.returncode = p->start(p->param);
   me->terminated = 1;
 
   // GC_psp2_delete_thread (sceKernelGetThreadId ());
@@ -188,6 +484,12 @@ EXTERN pthread_t pthread_self(void)
 {
   SceUID id;
 
+#ifdef TLS_SUPPORTED_
+  // Only set once the library is initialized
+  if (tls_self != NULL)
+    return tls_self;
+#endif
+
   PTHREAD_INIT();
 
   id = sceKernelGetThreadId();
@@ -200,6 +502,24 @@ EXTERN pthread_t pthread_self(void)
 }
 
 
+/*
+ * Storage of the calling thread if the library started it, or was
+ * initialized on it, and NULL otherwise: before the initialization, on
+ * the threads created directly with the kernel, and on the compilers
+ * without thread local storage.  Unlike pthread_self, it initializes
+ * nothing, makes no kernel call and never parses a thread name.
+ */
+
+EXTERN pthread_t pthread_current_(void)
+{
+#ifdef TLS_SUPPORTED_
+  return tls_self;
+#else
+  return NULL;
+#endif
+}
+
+
 EXTERN int pthread_equal(pthread_t t1, pthread_t t2)
 {
   return (t1 == t2);
@@ -208,17 +528,15 @@ EXTERN int pthread_equal(pthread_t t1, pthread_t t2)
 
 static void InitDefault(pthread_t th)
 {
-  INIT_CONTROL(th);
-
   memset(&th->specific_data, 0, sizeof(th->specific_data));
   th->specific_data_count = 0;
   th->cleanup = NULL;
-  th->joinable = 0; 
-  th->detached = th->joinable == PTHREAD_CREATE_DETACHED ? 1 : 0;
+  th->cold.joinable = 0; 
+  th->detached = th->cold.joinable == PTHREAD_CREATE_DETACHED ? 1 : 0;
   th->priority = 0;
-  th->condCBID = INVALID_ID_;
-  th->barrierCBID = INVALID_ID_;
-  th->joinCBID = INVALID_ID_;
+  th->cold.condCBID = INVALID_ID_;
+  th->cold.barrierCBID = INVALID_ID_;
+  th->cold.joinCBID = INVALID_ID_;
 
   /* The cancelability state and type of any newly created threads, 
    * including the thread in which main was first invoked, are
@@ -227,10 +545,27 @@ static void InitDefault(pthread_t th)
   th->cancel_type = PTHREAD_CANCEL_DEFERRED;
   th->cancel_state = PTHREAD_CANCEL_ENABLE;
   th->cancel_pending = 0;
-  th->waiting = 0;
+  th->cold.waiting = 0;
   th->terminated = 0;
   th->inWAIT = 0;
-  memset(th->priomutex, 0, sizeof(th->priomutex));
+  memset(th->cold.priomutex, 0, sizeof(th->cold.priomutex));
+  th->next = NULL;
+  th->prev = NULL;
+  th->rcu_ctr = 0;
+  th->rcu_nesting = 0;
+  th->mcs_used = 0;
+  th->hazard = NULL;
+  th->ebr_state = 0;
+  th->ebr_nesting = 0;
+  th->ebr_limbo = NULL;
+  th->ebr_count = 0;
+  memset(th->magazines, 0, sizeof(th->magazines));
+  th->alloc_cached = 0;
+  th->arena_top = NULL;
+  th->arena_end = NULL;
+  th->arena = NULL;
+  th->arena_spare = NULL;
+  th->pool_caches = NULL;
 }
 
 
@@ -263,6 +598,9 @@ EXTERN int pthread_create(pthread_t *thread,
   sceGlueParam_t p;
   pthread_t th;
   pthread_attr_t myattr;
+  size_t stacksize;
+  SceUID cbid;
+  void *base;
   
   PTHREAD_INIT();
 
@@ -271,46 +609,61 @@ EXTERN int pthread_create(pthread_t *thread,
   else
     myattr = *attr;
 
+  myattr.attr |= SCE_KERNEL_THREAD_ATTR_NOTIFY_EXCEPTION;
+
+  // With a stack supplied by the caller, the kernel stack only runs sceGlue
+  stacksize = myattr.stackaddr != NULL ? PTHREAD_STACK_MIN : myattr.stacksize;
+
   if (myattr.storage != NULL)
     {
 	  th = myattr.storage;
-	  th->needsfree = 0;
+	  th->cold.needsfree = 0;
+	  th->cold.pooled = 0;
+	  th->cold.kthread = INVALID_ID_;
+	  INIT_CONTROL(th);
     }
-  else
+  else if ((th = cache_get(stacksize, &myattr)) == NULL)
     {
-	  th = PTHREAD_MALLOC(sizeof(struct pthread_storage_t));
-	  if (th == NULL)
+	  base = PTHREAD_MALLOC(sizeof(struct pthread_storage_t) + PTHREAD_CACHELINE_SIZE_ - 1);
+	  if (base == NULL)
 	    return ENOMEM;
-	  th->needsfree = 1;
+	  th = ALIGN_STORAGE(base);
+	  th->cold.base = base;
+	  th->cold.needsfree = 1;
+	  th->cold.pooled = 0;
+	  th->cold.kthread = INVALID_ID_;
+	  INIT_CONTROL(th);
     }
 
+  // A callback belongs to the kernel thread that created it, so the cond
+  // callback of a dormant thread of the cache is still valid
+  cbid = th->cold.kthread != INVALID_ID_ ? th->cold.condCBID : INVALID_ID_;
   InitDefault(th);
+  th->cold.condCBID = cbid;
 
   // This code is a little bit kludgy, but we need thread specific data
   // to be returned by a sce* function.  We use the thread name to store
   // such a pointer.
   // See the pthread_get function below for matching code.
-  th->name[0] = C[((int)th >> 28) & 0xf];
-  th->name[1] = C[((int)th >> 24) & 0xf];
-  th->name[2] = C[((int)th >> 20) & 0xf];
-  th->name[3] = C[((int)th >> 16) & 0xf];
-  th->name[4] = C[((int)th >> 12) & 0xf];
-  th->name[5] = C[((int)th >>  8) & 0xf];
-  th->name[6] = C[((int)th >>  4) & 0xf];
-  th->name[7] = C[((int)th >>  0) & 0xf];
+  th->cold.name[0] = C[((int)th >> 28) & 0xf];
+  th->cold.name[1] = C[((int)th >> 24) & 0xf];
+  th->cold.name[2] = C[((int)th >> 20) & 0xf];
+  th->cold.name[3] = C[((int)th >> 16) & 0xf];
+  th->cold.name[4] = C[((int)th >> 12) & 0xf];
+  th->cold.name[5] = C[((int)th >>  8) & 0xf];
+  th->cold.name[6] = C[((int)th >>  4) & 0xf];
+  th->cold.name[7] = C[((int)th >>  0) & 0xf];
   
   // Update, Feb 2007: we now allow the user to specify a secondary name in the attributes.
   // This name, if set, will appear after the thread pointer in the debugger.
   if (myattr.name[0] == 0) {
-      th->name[8] = 0;
+      th->cold.name[8] = 0;
   } else {
-      th->name[8] = ' ';
+      th->cold.name[8] = ' ';
       for (i=0; i<sizeof(myattr.name); ++i)
-        th->name[9+i] = myattr.name[i];
+        th->cold.name[9+i] = myattr.name[i];
   }
 
-  myattr.attr |= SCE_KERNEL_THREAD_ATTR_NOTIFY_EXCEPTION;
-
   SceKernelThreadOptParam* threadOptParam = SCE_NULL;
 
   SceKernelThreadOptParamForMono threadOptParamForMono = {
@@ -328,21 +681,40 @@ EXTERN int pthread_create(pthread_t *thread,
 
   threadOptParam = (SceKernelThreadOptParam*)&threadOptParamForMono;
 
-  res1 = sceKernelCreateThread((const char *)th->name, 
-                               sceGlue, 
-                               myattr.priority, 
-                               myattr.stacksize, 
-                               myattr.attr,
-                               SCE_KERNEL_CPU_MASK_USER_ALL,
-                               threadOptParam);
+  if (th->cold.kthread != INVALID_ID_)
+    {
+      // Dormant thread of the cache, created with the same parameters
+      res1 = th->cold.kthread;
+      th->cold.kthread = INVALID_ID_;
+      res2 = sceKernelChangeThreadPriority(res1, myattr.priority);
+      if (res2 < 0)
+        {
+          // Back to the cache, the kernel thread is still dormant
+          sceCHECK(res2);
+          th->id = res1;
+          result = ERROR_errno_sce(res2);
+          goto fail;
+        }
+    }
+  else
+    res1 = sceKernelCreateThread((const char *)th->cold.name, 
+                                 sceGlue, 
+                                 myattr.priority, 
+                                 stacksize, 
+                                 myattr.attr,
+                                 SCE_KERNEL_CPU_MASK_USER_ALL,
+                                 threadOptParam);
 
  // printf("sceKernelCreateThread res:0x%x\n",res1);
 
   if (res1 <= 0) 
     {
+      th->id = DELETED_ID_;
       result = EAGAIN;
       goto fail;
     }
+  th->cold.stacksize = stacksize;
+  th->cold.kattr = myattr.attr;
 
   /* Register an event handler */
   /*
@@ -359,27 +731,30 @@ EXTERN int pthread_create(pthread_t *thread,
   p.start = start;
   p.param = param;
   p.thread = th;
+  p.stacktop = myattr.stackaddr != NULL
+    ? (void *)(((unsigned long)myattr.stackaddr + myattr.stacksize) & ~7UL) : NULL;
 
   th->id = res1;
-  th->joinable = myattr.joinable;
-  th->detached = th->joinable == PTHREAD_CREATE_DETACHED ? 1 : 0;
+  th->cold.joinable = myattr.joinable;
+  th->detached = th->cold.joinable == PTHREAD_CREATE_DETACHED ? 1 : 0;
   th->priority = myattr.priority;
 
   *thread = th;
   TRACE((void *)th, th->id, "Thread create");
 
+  register_thread(th);
   res2 = sceKernelStartThread(th->id, sizeof(p), &p);
 
   if (res2 != SCE_OK)
     {
+      unregister_thread(th);
       result = EAGAIN;
       goto fail;
     }
   return res2;
 
  fail:
-  if (th->needsfree)
-    PTHREAD_FREE(th);
+  release_storage(th, th->id, 0);
   return result;
 }
 
@@ -487,7 +862,7 @@ EXTERN int pthread_setcancelstate(int state, int *oldstate)
       state != PTHREAD_CANCEL_DISABLE)
     return EINVAL;
 
-  old = ATOMIC_LW_SW(&th->cancel_state, state);
+  old = ATOMIC_SWAP(&th->cancel_state, state, ATOMIC_RELAXED);
 
   if (oldstate != NULL)
     *oldstate = old;
@@ -505,7 +880,7 @@ EXTERN int pthread_setcanceltype(int type, int *oldtype)
       type != PTHREAD_CANCEL_ASYNCHRONOUS)
     return EINVAL;
 
-  old = ATOMIC_LW_SW(&th->cancel_type, type);
+  old = ATOMIC_SWAP(&th->cancel_type, type, ATOMIC_RELAXED);
 
   if (oldtype != NULL)
     *oldtype = old;
@@ -528,12 +903,14 @@ EXTERN void pthread_testcancel(void)
   cleanup(th);
   if (th->detached)
     {
+      // Deleted below, so not for the thread cache
+      th->id = DELETED_ID_;
       detach(th, 1);
     }
   else
     {
       th->id = DELETED_ID_;
-      th->returncode = PTHREAD_CANCELED;
+      th->cold.returncode = PTHREAD_CANCELED;
     }
   res = sceKernelExitDeleteThread(1);
   sceCHECK(res);
@@ -588,7 +965,7 @@ EXTERN int pthread_cancel(pthread_t thread)
     }
 //printf("Cancel - 2\n");
 
-  thread->returncode = PTHREAD_CANCELED;
+  thread->cold.returncode = PTHREAD_CANCELED;
   id = thread->id;
   thread->id = DELETED_ID_;
 
@@ -672,7 +1049,7 @@ EXTERN void pthread_exit(void *status)
   if (me->detached)
     detach(me, 1);
   else
-    me->returncode = status;
+    me->cold.returncode = status;
 
   sceKernelExitThread(1);
 }
@@ -713,7 +1090,7 @@ EXTERN int pthread_join(pthread_t thread, void **value_ptr)
 {
   int res, resCB, ret;
 
-  if (thread == NULL || thread->joinable != PTHREAD_CREATE_JOINABLE)
+  if (thread == NULL || thread->cold.joinable != PTHREAD_CREATE_JOINABLE)
     return EINVAL;
 
   LOCK_CONTROL(thread);
@@ -721,14 +1098,14 @@ EXTERN int pthread_join(pthread_t thread, void **value_ptr)
   if (thread->id == DELETED_ID_)
     {
       if (value_ptr != NULL) 
-        *value_ptr = thread->returncode;
+        *value_ptr = thread->cold.returncode;
       UNLOCK_CONTROL(thread);
       return 0;
     }
 
-  thread->waiting++;
+  thread->cold.waiting++;
 
-  if (thread->joinCBID == INVALID_ID_)
+  if (thread->cold.joinCBID == INVALID_ID_)
     {
       res = sceKernelCreateCallback("Wait Thread End", 0, CallbackHandler, NULL);
       if (res <= 0)
@@ -737,10 +1114,10 @@ EXTERN int pthread_join(pthread_t thread, void **value_ptr)
           UNLOCK_CONTROL(thread);
           return res;
         }
-      thread->joinCBID = res;
+      thread->cold.joinCBID = res;
     }
 
-  res = sceKernelNotifyCallback(thread->joinCBID, (int)thread->control);
+  res = sceKernelNotifyCallback(thread->cold.joinCBID, (int)thread->control);
   sceCHECK(res);
 
   res = sceKernelWaitThreadEndCB(thread->id, NULL, NULL);
@@ -759,12 +1136,12 @@ EXTERN int pthread_join(pthread_t thread, void **value_ptr)
 
   LOCK_CONTROL(thread);
 
-  thread->waiting--;
+  thread->cold.waiting--;
 
   if (value_ptr != NULL) 
-    *value_ptr = thread->returncode;
+    *value_ptr = thread->cold.returncode;
   
-  if (thread->waiting == 0)
+  if (thread->cold.waiting == 0)
     {
       /*
        * The target thread is automatically detached after all joined 
@@ -812,10 +1189,10 @@ EXTERN int pthread_join(pthread_t thread, void **value_ptr)
 EXTERN int pthread_detach(pthread_t thread)
 {
   if (thread == NULL || 
-      thread->joinable != PTHREAD_CREATE_JOINABLE)
+      thread->cold.joinable != PTHREAD_CREATE_JOINABLE)
     return EINVAL;
 
-  if (test_and_set_bit(0, &thread->detached))
+  if (ATOMIC_SWAP(&thread->detached, 1, ATOMIC_ACQ_REL))
     return EINVAL;
 
   return 0;
@@ -835,6 +1212,7 @@ EXTERN int pthread_attr_init(pthread_attr_t *attr)
 {
   attr->joinable = PTHREAD_CREATE_JOINABLE;
   attr->stacksize = PTHREAD_STACK_MIN;
+  attr->stackaddr = NULL;
 //  attr->priority = SCE_KERNEL_PROCESS_PRIORITY_USER_LOW;
   attr->priority = SCE_KERNEL_PROCESS_PRIORITY_USER_LOW + 1; // behavior changed from SDK 0990
   attr->attr = 0;
@@ -964,6 +1342,41 @@ EXTERN int pthread_attr_getstacksize(const pthread_attr_t *attr, size_t *stacksi
 }
 
 
+/*
+ * The kernel allocates the thread stacks itself: the created thread
+ * starts on a kernel stack of PTHREAD_STACK_MIN bytes, and sceGlue
+ * switches to the supplied stack before calling the start routine.
+ */
+
+EXTERN int pthread_attr_setstack(pthread_attr_t *attr, void *stackaddr, size_t stacksize)
+{
+#ifdef STACK_SWITCH_SUPPORTED_
+  if (stackaddr == NULL || stacksize < PTHREAD_STACK_MIN)
+    return EINVAL;
+
+  attr->stackaddr = stackaddr;
+  attr->stacksize = stacksize;
+  return 0;
+#else
+  (void)&attr;
+  (void)&stackaddr;
+  (void)&stacksize;
+  return ENOTSUP;
+#endif
+}
+
+
+EXTERN int pthread_attr_getstack(const pthread_attr_t *attr, void **stackaddr, size_t *stacksize)
+{
+  CHECK_PT_PTR(stackaddr);
+  CHECK_PT_PTR(stacksize);
+
+  *stackaddr = attr->stackaddr;
+  *stacksize = attr->stacksize;
+  return 0;
+}
+
+
 EXTERN int pthread_attr_getschedparam(const pthread_attr_t *attr, struct sched_param *param)
 {
   param->sched_priority = attr->priority;
@@ -994,12 +1407,19 @@ EXTERN void pthread_init_()
       pthread_mutex_init(&TRACE_MUTEX, NULL);
       
       // Create a pthread data structure for the UserMain thread
-      UserMainThread = &UserMainThreadStorage;
+      UserMainThread = ALIGN_STORAGE(UserMainThreadStorage);
       UserMainThread->id = sceKernelGetThreadId();
+#ifdef TLS_SUPPORTED_
+      tls_self = UserMainThread;
+#endif
+      INIT_CONTROL(UserMainThread);
       InitDefault(UserMainThread);
-      UserMainThread->joinable = 0; 
+      UserMainThread->cold.joinable = 0; 
       UserMainThread->detached = 1;
       //  UserMainThread->priority = attr->priority;
+      register_thread(UserMainThread);
+      pthread_hazard_acquire_(UserMainThread);
+      UserMainThread->alloc_cached = 1;
       
       pthread_enter_critical = enter_critical_func;
       pthread_leave_critical = leave_critical_func;
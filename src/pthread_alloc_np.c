@@ -0,0 +1,371 @@
+//Sony Computer Entertainment Confidential
+#include "pthread/include/pthread.h"
+
+/*
+ * Allocator of the library.  All the internal allocations go through
+ * PTHREAD_MALLOC and PTHREAD_FREE, which call the allocator installed
+ * with pthread_set_allocator_np, or by default the bundled allocator.
+ *
+ * The bundled allocator serves the small sizes from size classes of
+ * 16 << class bytes, with magazines after Bonwick: every thread caches
+ * two magazines of free blocks per class in its pthread_storage_t, and
+ * only exchanges whole magazines with the depot, which is made of lock
+ * free LIFOs.  The common path is thus a few instructions on the
+ * thread's own data.  Blocks are carved from chunks allocated with
+ * malloc, and never given back to it.  The larger sizes go directly to
+ * malloc.
+ *
+ * Every block is preceded by a header giving its class, so that free
+ * needs no size.  The blocks of an installed allocator have the CUSTOM
+ * class, and a second header word pointing to the descriptor of that
+ * allocator: a block is thus always freed by the allocator which
+ * allocated it, whatever was installed since.  The descriptors are
+ * never modified nor freed, so that a thread allocating while another
+ * installs an allocator uses either the old one or the new one whole.
+ *
+ * The magazines are only used by the threads found through thread
+ * local storage (see pthread_current_).  The other threads, such as
+ * the ones created directly with the kernel, go to the depot.
+ */
+
+#define HEADER          8       // Keeps the blocks 8 byte aligned
+#define LARGE           PTHREAD_ALLOC_CLASSES_
+#define CUSTOM          (LARGE + 1)     // Block of the installed allocator
+#define CHUNK_BLOCKS    PTHREAD_MAGAZINE_SIZE_  // Blocks carved at a time, a magazine
+
+#define CLASS_SIZE(c)   (16UL << (c))
+#define BLOCK(p)        ((unsigned long *)((char *)(p) - HEADER))
+
+typedef struct descriptor_t
+{
+  pthread_allocator_t   a;
+  struct descriptor_t  *next;           // Every descriptor ever made
+} descriptor_t;
+
+static descriptor_t * volatile installed = NULL;        // NULL for the bundled allocator
+static descriptor_t * volatile descriptors = NULL;
+
+/* Depot: full (or partially filled) and empty magazines, and free
+   blocks released without a thread cache */
+static pthread_lifo_t full[PTHREAD_ALLOC_CLASSES_];
+static pthread_lifo_t empty[PTHREAD_ALLOC_CLASSES_];
+static pthread_lifo_t blocks[PTHREAD_ALLOC_CLASSES_];
+
+
+/*
+ * Install the allocator used by the library, or the bundled one if a
+ * is NULL.  The descriptor of a is published with a single pointer
+ * store, after it is complete; the descriptor of an allocator
+ * installed before is reused.
+ */
+
+EXTERN int pthread_set_allocator_np(const pthread_allocator_t *a)
+{
+  descriptor_t *d, *head;
+
+  if (a == NULL)
+    {
+      ATOMIC_STORE_PTR(&installed, NULL, ATOMIC_RELEASE);
+      return 0;
+    }
+  if (a->alloc == NULL || a->free == NULL)
+    return EINVAL;
+
+  for (d = (descriptor_t *)ATOMIC_LOAD_PTR(&descriptors, ATOMIC_ACQUIRE); d != NULL; d = d->next)
+    if (d->a.alloc == a->alloc && d->a.free == a->free && d->a.ctx == a->ctx)
+      break;
+
+  if (d == NULL)
+    {
+      d = (descriptor_t *)malloc(sizeof(descriptor_t));
+      if (d == NULL)
+        return ENOMEM;
+      d->a = *a;
+      do
+        {
+          head = (descriptor_t *)ATOMIC_LOAD_PTR(&descriptors, ATOMIC_RELAXED);
+          d->next = head;
+        }
+      while (ATOMIC_CAS_PTR(&descriptors, head, d, ATOMIC_RELEASE) != head);
+    }
+
+  ATOMIC_STORE_PTR(&installed, d, ATOMIC_RELEASE);
+  return 0;
+}
+
+
+EXTERN int pthread_get_allocator_np(pthread_allocator_t *a)
+{
+  descriptor_t *d;
+
+  CHECK_PT_PTR(a);
+
+  d = (descriptor_t *)ATOMIC_LOAD_PTR(&installed, ATOMIC_ACQUIRE);
+  if (d != NULL)
+    *a = d->a;
+  else
+    {
+      a->alloc = NULL;
+      a->free = NULL;
+      a->ctx = NULL;
+    }
+  return 0;
+}
+
+
+static inline int size_class(size_t size)
+{
+  int c;
+
+  for (c = 0; c < PTHREAD_ALLOC_CLASSES_; c++)
+    if (size + HEADER <= CLASS_SIZE(c))
+      break;
+  return c;
+}
+
+
+/*
+ * Allocate a block of class c from the free blocks, or from a new chunk.
+ */
+
+static void *carve(int c)
+{
+  char *chunk;
+  unsigned long *b;
+  int i;
+
+  b = (unsigned long *)pthread_lifo_pop_np(&blocks[c]);
+  if (b != NULL)
+    return b;
+
+  chunk = (char *)malloc(CHUNK_BLOCKS * CLASS_SIZE(c));
+  if (chunk == NULL)
+    return NULL;
+  for (i = 1; i < CHUNK_BLOCKS; i++)
+    pthread_lifo_push_np(&blocks[c], (pthread_lifo_node_t *)(chunk + i * CLASS_SIZE(c)));
+  return chunk;
+}
+
+
+/*
+ * Returns an empty magazine of the depot, or a new one.
+ */
+
+static pthread_magazine_t *empty_magazine(int c)
+{
+  pthread_magazine_t *m;
+
+  m = (pthread_magazine_t *)pthread_lifo_pop_np(&empty[c]);
+  if (m == NULL)
+    {
+      m = (pthread_magazine_t *)malloc(sizeof(pthread_magazine_t));
+      if (m == NULL)
+        return NULL;
+      m->count = 0;
+    }
+  return m;
+}
+
+
+/*
+ * Fill the empty magazine m with the free blocks of class c, taken from
+ * the depot in one operation, or else with a new chunk.  Returns the
+ * number of blocks.
+ */
+
+static int fill(pthread_magazine_t *m, int c)
+{
+  pthread_lifo_node_t *node, *last;
+  char *chunk;
+  int i;
+
+  node = pthread_lifo_pop_all_np(&blocks[c]);
+  while (node != NULL && m->count < PTHREAD_MAGAZINE_SIZE_)
+    {
+      m->rounds[m->count++] = node;
+      node = node->next;
+    }
+  if (node != NULL)
+    {
+      // Give back the blocks left over, in one operation too
+      for (last = node; last->next != NULL; last = last->next)
+        ;
+      pthread_lifo_push_chain_np(&blocks[c], node, last);
+    }
+  if (m->count > 0)
+    return m->count;
+
+  chunk = (char *)malloc(CHUNK_BLOCKS * CLASS_SIZE(c));
+  if (chunk == NULL)
+    return 0;
+  for (i = 0; i < CHUNK_BLOCKS; i++)
+    m->rounds[m->count++] = chunk + i * CLASS_SIZE(c);
+  return m->count;
+}
+
+
+static void *cached_alloc(pthread_t me, int c)
+{
+  pthread_magazine_t **mag = me->magazines[c];
+  pthread_magazine_t *m;
+
+  if (mag[0] != NULL && mag[0]->count > 0)
+    return mag[0]->rounds[--mag[0]->count];
+
+  if (mag[1] != NULL && mag[1]->count > 0)
+    {
+      m = mag[0];
+      mag[0] = mag[1];
+      mag[1] = m;
+      return mag[0]->rounds[--mag[0]->count];
+    }
+
+  // Both are empty, exchange one for a full magazine of the depot
+  m = (pthread_magazine_t *)pthread_lifo_pop_np(&full[c]);
+  if (m != NULL)
+    {
+      if (mag[1] != NULL)
+        pthread_lifo_push_np(&empty[c], &mag[1]->node);
+      mag[1] = mag[0];
+      mag[0] = m;
+      return m->rounds[--m->count];
+    }
+
+  // Or refill one with a batch of blocks, so that the next allocations
+  // are served by the magazine again
+  if (mag[0] == NULL && (mag[0] = empty_magazine(c)) == NULL)
+    return carve(c);
+  if (fill(mag[0], c) == 0)
+    return NULL;
+  return mag[0]->rounds[--mag[0]->count];
+}
+
+
+static void cached_free(pthread_t me, int c, void *b)
+{
+  pthread_magazine_t **mag = me->magazines[c];
+  pthread_magazine_t *m;
+
+  if (mag[0] != NULL && mag[0]->count < PTHREAD_MAGAZINE_SIZE_)
+    {
+      mag[0]->rounds[mag[0]->count++] = b;
+      return;
+    }
+
+  if (mag[1] != NULL && mag[1]->count < PTHREAD_MAGAZINE_SIZE_)
+    {
+      m = mag[0];
+      mag[0] = mag[1];
+      mag[1] = m;
+      mag[0]->rounds[mag[0]->count++] = b;
+      return;
+    }
+
+  // Both are full (or missing), exchange one for an empty magazine
+  m = empty_magazine(c);
+  if (m == NULL)
+    {
+      pthread_lifo_push_np(&blocks[c], (pthread_lifo_node_t *)b);
+      return;
+    }
+  if (mag[1] != NULL)
+    pthread_lifo_push_np(&full[c], &mag[1]->node);
+  mag[1] = mag[0];
+  mag[0] = m;
+  m->rounds[m->count++] = b;
+}
+
+
+EXTERN void *pthread_malloc_(size_t size)
+{
+  descriptor_t *d;
+  pthread_t me;
+  unsigned long *b;
+  int c;
+
+  d = (descriptor_t *)ATOMIC_LOAD_PTR(&installed, ATOMIC_ACQUIRE);
+  if (d != NULL)
+    {
+      // The descriptor goes in a header word of its own, before the class
+      c = CUSTOM;
+      b = (unsigned long *)d->a.alloc(d->a.ctx, size + 2 * HEADER);
+      if (b == NULL)
+        return NULL;
+      *(descriptor_t **)b = d;
+      b = (unsigned long *)((char *)b + HEADER);
+    }
+  else if ((c = size_class(size)) == LARGE)
+    b = (unsigned long *)malloc(size + HEADER);
+  else
+    {
+      me = pthread_current_();
+      if (me != NULL && me->alloc_cached)
+        b = (unsigned long *)cached_alloc(me, c);
+      else
+        b = (unsigned long *)carve(c);
+    }
+  if (b == NULL)
+    return NULL;
+
+  b[0] = c;
+  return (char *)b + HEADER;
+}
+
+
+EXTERN void pthread_free_(void *ptr)
+{
+  descriptor_t *d;
+  pthread_t me;
+  unsigned long *b;
+  int c;
+
+  if (ptr == NULL)
+    return;
+
+  b = BLOCK(ptr);
+  c = (int)b[0];
+  if (c == CUSTOM)
+    {
+      b = (unsigned long *)((char *)b - HEADER);
+      d = *(descriptor_t **)b;
+      d->a.free(d->a.ctx, b);
+      return;
+    }
+  if (c == LARGE)
+    {
+      free(b);
+      return;
+    }
+
+  me = pthread_current_();
+  if (me != NULL && me->alloc_cached)
+    cached_free(me, c, b);
+  else
+    pthread_lifo_push_np(&blocks[c], (pthread_lifo_node_t *)b);
+}
+
+
+/*
+ * Give the magazines of th back to the depot.  Its later allocations,
+ * during its exit, go to the depot directly.
+ */
+
+EXTERN void pthread_alloc_release_(pthread_t th)
+{
+  pthread_magazine_t *m;
+  int c, i;
+
+  th->alloc_cached = 0;
+  for (c = 0; c < PTHREAD_ALLOC_CLASSES_; c++)
+    for (i = 0; i < 2; i++)
+      {
+        m = th->magazines[c][i];
+        th->magazines[c][i] = NULL;
+        if (m == NULL)
+          continue;
+        if (m->count > 0)
+          pthread_lifo_push_np(&full[c], &m->node);
+        else
+          pthread_lifo_push_np(&empty[c], &m->node);
+      }
+}
@@ -0,0 +1,199 @@
+//Sony Computer Entertainment Confidential
+#include "pthread/include/pthread.h"
+
+/*
+ * Bump arena of the calling thread.  Allocating moves the top of the
+ * current chunk, and a new chunk is linked in front when it is full;
+ * releasing to a mark gives back the chunks allocated since, and sets
+ * the top back.  The arena is only touched by its thread, so none of
+ * this takes a lock or an atomic operation.
+ *
+ * The last released chunk of the default size is kept as a spare, so
+ * that a job allocating a little more than a chunk and releasing it
+ * does not call the allocator every time.
+ */
+
+#define ALIGN           8
+#define CHUNK_SIZE      (16 * 1024)     // Default size of a chunk, header included
+#define HEADER          ((sizeof(pthread_arena_chunk_t) + ALIGN - 1) & ~(ALIGN - 1))
+
+#define DATA(c)         ((char *)(c) + HEADER)
+#define END(c)          (DATA(c) + (c)->size)
+
+
+static void recycle(pthread_t me, pthread_arena_chunk_t *c)
+{
+  if (me->arena_spare == NULL && c->size == CHUNK_SIZE - HEADER)
+    me->arena_spare = c;
+  else
+    PTHREAD_FREE(c);
+}
+
+
+static void *grow(pthread_t me, size_t size)
+{
+  pthread_arena_chunk_t *c;
+  size_t n;
+
+  n = size > CHUNK_SIZE - HEADER ? size : CHUNK_SIZE - HEADER;
+  c = me->arena_spare;
+  if (c != NULL && c->size >= n)
+    me->arena_spare = NULL;
+  else
+    {
+      // The tail of the current chunk is lost until it is released
+      c = (pthread_arena_chunk_t *)PTHREAD_MALLOC(HEADER + n);
+      if (c == NULL)
+        return NULL;
+      c->size = n;
+    }
+
+  c->next = me->arena;
+  me->arena = c;
+  me->arena_top = DATA(c) + size;
+  me->arena_end = END(c);
+  return DATA(c);
+}
+
+
+/*
+ * Allocate size bytes, aligned on 8 bytes, in the arena of the calling
+ * thread.  Returns NULL when out of memory.  A size of 0 takes 8 bytes,
+ * so that every allocation is a distinct pointer.
+ */
+
+EXTERN void *pthread_arena_alloc_np(size_t size)
+{
+  pthread_t me = pthread_self();
+  char *p;
+
+  size = size != 0 ? (size + ALIGN - 1) & ~(size_t)(ALIGN - 1) : ALIGN;
+  p = me->arena_top;
+  if ((size_t)(me->arena_end - p) < size)
+    return grow(me, size);
+  me->arena_top = p + size;
+  return p;
+}
+
+
+EXTERN int pthread_arena_mark_np(pthread_arena_mark_t *mark)
+{
+  pthread_t me = pthread_self();
+
+  CHECK_PT_PTR(mark);
+
+  mark->chunk = me->arena;
+  mark->top = me->arena_top;
+  return 0;
+}
+
+
+/*
+ * Release everything allocated since mark was taken.  The marks taken
+ * since are invalid afterwards.  A mark which is not one of the arena
+ * of the calling thread is rejected before anything is released.
+ */
+
+EXTERN int pthread_arena_release_np(const pthread_arena_mark_t *mark)
+{
+  pthread_t me = pthread_self();
+  pthread_arena_chunk_t *c;
+
+  CHECK_PT_PTR(mark);
+
+  if (mark->chunk != NULL)
+    {
+      for (c = me->arena; c != NULL && c != mark->chunk; c = c->next)
+        ;
+      if (c == NULL || mark->top < DATA(c) || mark->top > END(c))
+        return EINVAL;          // Not a mark of this arena
+    }
+
+  while (me->arena != mark->chunk)
+    {
+      c = me->arena;
+      me->arena = c->next;
+      recycle(me, c);
+    }
+
+  if (mark->chunk != NULL)
+    {
+      me->arena_top = mark->top;
+      me->arena_end = END(mark->chunk);
+    }
+  else
+    {
+      me->arena_top = NULL;
+      me->arena_end = NULL;
+    }
+  return 0;
+}
+
+
+/*
+ * Release everything allocated in the arena, typically at the end of
+ * a job.
+ */
+
+EXTERN int pthread_arena_reset_np(void)
+{
+  static const pthread_arena_mark_t empty = { NULL, NULL };
+
+  return pthread_arena_release_np(&empty);
+}
+
+
+/*
+ * Hand everything allocated so far in the arena of the calling thread
+ * off to *arena, leaving the arena empty.  The allocations stay valid
+ * until pthread_arena_free_np is called on *arena, by any thread.
+ */
+
+EXTERN int pthread_arena_handoff_np(pthread_arena_t *arena)
+{
+  pthread_t me = pthread_self();
+
+  CHECK_PT_PTR(arena);
+
+  arena->chunks = me->arena;
+  me->arena = NULL;
+  me->arena_top = NULL;
+  me->arena_end = NULL;
+  return 0;
+}
+
+
+EXTERN int pthread_arena_free_np(pthread_arena_t *arena)
+{
+  pthread_arena_chunk_t *c, *next;
+
+  CHECK_PT_PTR(arena);
+
+  for (c = arena->chunks; c != NULL; c = next)
+    {
+      next = c->next;
+      PTHREAD_FREE(c);
+    }
+  arena->chunks = NULL;
+  return 0;
+}
+
+
+/*
+ * Free the arena of an exiting thread.
+ */
+
+EXTERN void pthread_arena_release_(pthread_t th)
+{
+  pthread_arena_chunk_t *c, *next;
+
+  for (c = th->arena; c != NULL; c = next)
+    {
+      next = c->next;
+      PTHREAD_FREE(c);
+    }
+  th->arena = NULL;
+  th->arena_top = NULL;
+  th->arena_end = NULL;
+  PTHREAD_FREE(th->arena_spare);
+}
@@ -1,27 +1,23 @@
 //Sony Computer Entertainment Confidential
 #include "pthread/include/pthread.h"
+#include <string.h> // memset
 
 /* Common definitions */
 #define VALID(barrier) \
-	(((barrier) != 0) && ((barrier)->control != INVALID_ID_))
+	(((barrier) != 0) && ((barrier)->queue[0] != INVALID_ID_))
 #define INVALIDATE(barrier) \
-	do { (barrier)->control = INVALID_ID_; } while(0)
+	do { (barrier)->queue[0] = INVALID_ID_; } while(0)
 
-#if 0
-static int CallbackHandler(SceUID notifyId, int count, int arg, void *common)
-{
-  pthread_barrier_t *b = (pthread_barrier_t*)arg;
+// Number of polls of the phase before parking in the kernel
+#define BARRIER_SPIN_COUNT   2000
 
-  // Unused parameters
-  (void)&count;
-  (void)&common;
-  (void)&notifyId;
+// Tree barriers
+#define DEFAULT_FANIN        4
+#define MAX_FANIN            8
 
-  // Release the barrier control
-  UNLOCK_CONTROL(b);
-  return 0;
-}
-#endif
+// Reductions
+#define NO_REDUCTION         (-1)
+#define REDUCE_REAL          0x100      // Or'ed to the operator for floats
 
 /*
  * The pthread_barrier_destroy subroutine destroys the 
@@ -56,25 +52,63 @@ static int CallbackHandler(SceUID notifyId, int count, int arg, void *common)
 
 EXTERN int pthread_barrier_destroy(pthread_barrier_t *barrier)
 {
-  int rc, res = 0;
-
   if (!VALID(barrier)) return EINVAL;
 
   ENTER_CRITICAL();
 
-  DELETE_CONTROL(barrier);
-
-  rc = sceKernelDeleteSema(barrier->queue);
-  if (rc)
-    {
-      sceCHECK(rc);
-	  res = ERROR_errno_sce(rc);
-    }
-  else
-    INVALIDATE(barrier);
+  pthread_sema_put_(PTHREAD_SEMA_WAIT_, barrier->queue[1]);
+  pthread_sema_put_(PTHREAD_SEMA_WAIT_, barrier->queue[0]);
+  PTHREAD_FREE(barrier->mem);
+  PTHREAD_FREE(barrier->slots);
+  barrier->nodes = NULL;
+  INVALIDATE(barrier);
 
   LEAVE_CRITICAL();
-  return res;
+  return 0;
+}
+
+
+/*
+ * Lay out the tree of a tree barrier, level by level starting with the
+ * leaves.  Every node is completed by up to fanin arrivals: threads for
+ * the leaves, winners of the level below for the other nodes.
+ */
+
+static int build_tree(pthread_barrier_t *barrier, unsigned int count, int fanin)
+{
+  pthread_barrier_node_t *node;
+  unsigned long below, size, total, offset, j;
+
+  total = 0;
+  size = count;
+  do {
+    size = (size + fanin - 1) / fanin;
+    total += size;
+  } while (size > 1);
+
+  barrier->mem = PTHREAD_MALLOC(total * sizeof(pthread_barrier_node_t) + PTHREAD_CACHELINE_SIZE_ - 1);
+  if (barrier->mem == NULL)
+    return ENOMEM;
+  barrier->nodes = (pthread_barrier_node_t *)
+    (((unsigned long)barrier->mem + PTHREAD_CACHELINE_SIZE_ - 1) & ~(PTHREAD_CACHELINE_SIZE_ - 1));
+  memset(barrier->nodes, 0, total * sizeof(pthread_barrier_node_t));
+
+  barrier->leaves = (count + fanin - 1) / fanin;
+  offset = 0;
+  below = count;
+  do {
+    size = (below + fanin - 1) / fanin;
+    for (j = 0; j < size; j++)
+      {
+        node = &barrier->nodes[offset + j];
+        node->capacity = below - j * fanin < (unsigned long)fanin ? below - j * fanin : fanin;
+        node->parent = size == 1 ? -1 : offset + size + j / fanin;
+      }
+    offset += size;
+    below = size;
+  } while (size > 1);
+
+  return 0;
 }
 
 
@@ -84,40 +118,64 @@ EXTERN int pthread_barrier_init(pthread_barrier_t *barrier,
 {
   int rc;
 
-  // Unused parameters
-  (void)&barrierattr;
-
   PTHREAD_INIT();
 
   if (count < 1 || barrier == NULL)
     return EINVAL;
+  // A fan-in of 1 or less would never shrink the tree
+  if (barrierattr != NULL && barrierattr->type == PTHREAD_BARRIER_TREE_NP &&
+      (barrierattr->fanin < 2 || barrierattr->fanin > MAX_FANIN))
+    return EINVAL;
+
+  barrier->type = barrierattr ? barrierattr->type : PTHREAD_BARRIER_CENTRAL_NP;
+  barrier->leaves = 0;
+  barrier->nodes = NULL;
+  barrier->mem = NULL;
+  barrier->tickets = 0;
+  barrier->slots = (pthread_barrier_value_t *)PTHREAD_MALLOC(count * sizeof(pthread_barrier_value_t));
+  if (barrier->slots == NULL)
+    {
+      INVALIDATE(barrier);
+      return ENOMEM;
+    }
+  if (barrier->type == PTHREAD_BARRIER_TREE_NP)
+    {
+      rc = build_tree(barrier, count, barrierattr->fanin);
+      if (rc)
+        {
+          PTHREAD_FREE(barrier->slots);
+          INVALIDATE(barrier);
+          return rc;
+        }
+    }
 
   ENTER_CRITICAL();
   
-  rc = sceKernelCreateSema("pthread barrier (c)",
-			   SCE_KERNEL_ATTR_TH_FIFO,
-			   1, 0x7fffffff, NULL);
+  rc = pthread_sema_get_(PTHREAD_SEMA_WAIT_, "pthread barrier (q0)");
   if (rc > 0) 
     {
-      barrier->control = rc;
-      TRACE(barrier, barrier->control, "barrier->control");
+      barrier->queue[0] = rc;
+      TRACE(barrier, barrier->queue[0], "barrier->queue[0]");
   
-      rc = sceKernelCreateSema("pthread barrier (q)",
-                   SCE_KERNEL_ATTR_TH_FIFO,
-                   0, count, NULL);
+      rc = pthread_sema_get_(PTHREAD_SEMA_WAIT_, "pthread barrier (q1)");
       if (rc > 0) 
 	    {
-          barrier->queue = rc;
-          TRACE(barrier, barrier->queue, "barrier->queue");
+          barrier->queue[1] = rc;
+          TRACE(barrier, barrier->queue[1], "barrier->queue[1]");
   
           barrier->neededcount = count;
           barrier->count = 0;
+          barrier->phase = 0;
+          barrier->sleepers[0] = 0;
+          barrier->sleepers[1] = 0;
+          barrier->orphans[0] = 0;
+          barrier->orphans[1] = 0;
 		  rc = 0;
         }
 	  else
 	    {
           sceCHECK(rc);
-		  sceKernelDeleteSema(barrier->control);
+		  pthread_sema_put_(PTHREAD_SEMA_WAIT_, barrier->queue[0]);
 		  INVALIDATE(barrier);
         }
     }
@@ -126,42 +184,364 @@ EXTERN int pthread_barrier_init(pthread_barrier_t *barrier,
       sceCHECK(rc);
 	  INVALIDATE(barrier);
     }
+  if (rc)
+    {
+      PTHREAD_FREE(barrier->mem);
+      PTHREAD_FREE(barrier->slots);
+    }
 
   LEAVE_CRITICAL();
   return ERROR_errno_sce(rc);
 }
 
 
+/*
+ * Wake up the threads parked on the queue of the given sense.  Every
+ * registration in sleepers[] is consumed by exactly one caller, which
+ * posts the matching semaphore count.
+ */
+
+static void wake(pthread_barrier_t *barrier, int sense)
+{
+  long n;
+  int res;
+
+  n = ATOMIC_SWAP(&barrier->sleepers[sense], 0, ATOMIC_ACQ_REL);
+  if (n > 0)
+    {
+      res = sceKernelSignalSema(barrier->queue[sense], n);
+      sceCHECK(res);
+    }
+}
+
+
+/*
+ * Wait for the end of phase: poll flag until it holds the next phase,
+ * then park on the semaphore selected by the sense of the phase, so
+ * that a thread already racing to the next phase cannot consume our
+ * wake up.  The barrier phase is always bumped before any flag is.
+ */
+
+static void await(pthread_barrier_t *barrier, volatile unsigned long *flag, unsigned long phase)
+{
+  int sense, spin, res;
+
+  for (spin = 0; spin < BARRIER_SPIN_COUNT; spin++)
+    if (*flag == phase + 1)
+      {
+        ATOMIC_FENCE(ATOMIC_ACQUIRE);
+        return;
+      }
+
+  // Either the releaser sees our registration, or we see the new
+  // phase and post the wake up ourselves.
+  sense = phase & 1;
+  ATOMIC_FETCH_ADD(&barrier->sleepers[sense], 1, ATOMIC_SEQ_CST);
+  if (barrier->phase != phase)
+    wake(barrier, sense);
+
+  res = sceKernelWaitSema(barrier->queue[sense], 1, NULL);
+  sceCHECK(res);
+  ATOMIC_FENCE(ATOMIC_ACQUIRE);
+}
+
+
+/*
+ * Combine the values contributed to the phase, on behalf of the thread
+ * completing it: every contribution was stored before its thread
+ * arrived.
+ */
+
+static void reduce(pthread_barrier_t *barrier, unsigned long phase, int op)
+{
+  pthread_barrier_value_t *slots = barrier->slots;
+  pthread_barrier_value_t r = slots[0];
+  long i, n = barrier->tickets;
+
+  for (i = 1; i < n; i++)
+    switch (op)
+      {
+      case PTHREAD_REDUCE_SUM_NP:   r.l += slots[i].l; break;
+      case PTHREAD_REDUCE_MIN_NP:   if (slots[i].l < r.l) r.l = slots[i].l; break;
+      case PTHREAD_REDUCE_MAX_NP:   if (slots[i].l > r.l) r.l = slots[i].l; break;
+      case PTHREAD_REDUCE_AND_NP:   r.l &= slots[i].l; break;
+      case PTHREAD_REDUCE_OR_NP:    r.l |= slots[i].l; break;
+      case PTHREAD_REDUCE_XOR_NP:   r.l ^= slots[i].l; break;
+      case PTHREAD_REDUCE_SUM_NP | REDUCE_REAL:   r.f += slots[i].f; break;
+      case PTHREAD_REDUCE_MIN_NP | REDUCE_REAL:   if (slots[i].f < r.f) r.f = slots[i].f; break;
+      case PTHREAD_REDUCE_MAX_NP | REDUCE_REAL:   if (slots[i].f > r.f) r.f = slots[i].f; break;
+      }
+
+  barrier->result[phase & 1] = r;
+  barrier->tickets = 0;
+}
+
+
+/*
+ * Central barrier: the arrivals are counted with an atomic increment,
+ * the last thread to arrive resets the count and releases the others
+ * by bumping the phase.  In the common case where the waiters are
+ * released while polling, a phase costs no kernel call at all.
+ */
+
+static void central_arrive(pthread_barrier_t *barrier, int op, pthread_barrier_token_t *token)
+{
+  unsigned long phase;
+
+  phase = barrier->phase;
+
+  token->phase = phase;
+  token->serial = 0;
+  if (ATOMIC_FETCH_ADD(&barrier->count, 1, ATOMIC_ACQ_REL) + 1 == barrier->neededcount)
+    {
+      barrier->count = 0;
+      if (op != NO_REDUCTION)
+        reduce(barrier, phase, op);
+      // Everything done before the barrier is visible to the released threads
+      ATOMIC_STORE((volatile long *)&barrier->phase, phase + 1, ATOMIC_RELEASE);
+      wake(barrier, phase & 1);
+      token->serial = 1;
+    }
+}
+
+
+/*
+ * Arrive at node for the phase whose low bits are tag.  A node whose
+ * state carries an older tag is empty: nodes never need to be reset.
+ *
+ * Returns 1 if we completed the node, 0 if we did not, or -1 if the
+ * node was already complete (this only happens to leaves).
+ */
+
+static int arrive(pthread_barrier_node_t *node, long tag)
+{
+  long old, count;
+
+  do {
+    old = node->state;
+    count = (old >> 16) == tag ? (old & 0xffff) : 0;
+    if (count >= node->capacity)
+      return -1;
+  } while (ATOMIC_CAS_EXPLICIT(&node->state, old, (tag << 16) | (count + 1), ATOMIC_ACQ_REL) != old);
+
+  return count + 1 == node->capacity;
+}
+
+
+/*
+ * Release the nodes won by the thread of token, from the top down.
+ */
+
+static void release(pthread_barrier_t *barrier, pthread_barrier_token_t *token)
+{
+  while (token->depth > 0)
+    ATOMIC_STORE((volatile long *)&barrier->nodes[token->path[--token->depth]].phase,
+                 token->phase + 1, ATOMIC_RELEASE);
+}
+
+
+/*
+ * Release every node, the root last in the array.
+ */
+
+static void release_all(pthread_barrier_t *barrier, unsigned long phase)
+{
+  pthread_barrier_node_t *node;
+
+  for (node = barrier->nodes; ; node++)
+    {
+      ATOMIC_STORE((volatile long *)&node->phase, phase + 1, ATOMIC_RELEASE);
+      if (node->parent < 0)
+        break;
+    }
+}
+
+
+/*
+ * Tree barrier: a thread arrives at a leaf picked from its identity,
+ * moving to the next one while the leaf is already complete, and the
+ * thread completing a node carries the arrival to the parent node.
+ * The thread completing the root starts the next phase and releases
+ * the nodes it won; every thread released from a node in turn
+ * releases the nodes it won below it.
+ *
+ * A split arrival releases nothing in its wait, which only polls the
+ * phase: when it wins nodes below the root, it flags them as orphans
+ * before going up, and the thread completing the root then releases
+ * the whole tree.
+ */
+
+static void tree_arrive(pthread_barrier_t *barrier, int op, pthread_barrier_token_t *token, int split)
+{
+  pthread_barrier_node_t *nodes = barrier->nodes;
+  unsigned long phase;
+  long n, tag;
+  int won;
+
+  phase = ATOMIC_LOAD((volatile long *)&barrier->phase, ATOMIC_ACQUIRE);
+  tag = phase & 0x7fff;
+
+  n = (((unsigned long)pthread_self() * 2654435761UL) >> 16) % barrier->leaves;
+  while ((won = arrive(&nodes[n], tag)) < 0)
+    n = n + 1 == barrier->leaves ? 0 : n + 1;
+
+  token->phase = phase;
+  token->depth = 0;
+  while (won)
+    {
+      token->path[token->depth++] = n;
+      if (nodes[n].parent < 0)
+        break;
+      // Published to the root by the arrival at the parent
+      if (split)
+        ATOMIC_STORE(&barrier->orphans[phase & 1], 1, ATOMIC_RELAXED);
+      n = nodes[n].parent;
+      won = arrive(&nodes[n], tag);
+    }
+  token->node = split ? -1 : n;
+  token->serial = won;
+
+  if (won)
+    {
+      if (op != NO_REDUCTION)
+        reduce(barrier, phase, op);
+      // Root: everything done before the barrier is visible to the released threads
+      ATOMIC_STORE((volatile long *)&barrier->phase, phase + 1, ATOMIC_RELEASE);
+      // The next phase uses the other sense, this one is free to reset
+      if (barrier->orphans[phase & 1])
+        {
+          barrier->orphans[phase & 1] = 0;
+          release_all(barrier, phase);
+          token->depth = 0;
+        }
+      else
+        release(barrier, token);
+      wake(barrier, phase & 1);
+    }
+}
+
+
+static void arrive_phase(pthread_barrier_t *barrier, int op, pthread_barrier_token_t *token, int split)
+{
+  if (barrier->type == PTHREAD_BARRIER_TREE_NP)
+    tree_arrive(barrier, op, token, split);
+  else
+    central_arrive(barrier, op, token);
+}
+
+
+static int wait_token(pthread_barrier_t *barrier, pthread_barrier_token_t *token)
+{
+  if (token->serial)
+    return PTHREAD_BARRIER_SERIAL_THREAD;
+
+  if (barrier->type == PTHREAD_BARRIER_TREE_NP && token->node >= 0)
+    {
+      await(barrier, &barrier->nodes[token->node].phase, token->phase);
+      release(barrier, token);
+    }
+  else
+    await(barrier, &barrier->phase, token->phase);
+  return 0;
+}
+
+
+static int wait_phase(pthread_barrier_t *barrier, int op)
+{
+  pthread_barrier_token_t token;
+
+  arrive_phase(barrier, op, &token, 0);
+  return wait_token(barrier, &token);
+}
+
+
 EXTERN int pthread_barrier_wait(pthread_barrier_t *barrier)
 {
-	int res;
-	pthread_t me = pthread_self();
+  if (!VALID(barrier)) return EINVAL;
+
+  return wait_phase(barrier, NO_REDUCTION);
+}
+
+
+/*
+ * A contribution is stored in the slot of the ticket drawn by its
+ * thread before the thread arrives, so the thread completing the phase
+ * finds all of them in place.  The result is kept per sense: it cannot
+ * be overwritten before every thread of the phase has arrived at the
+ * next one, that is has read it.
+ */
+
+static int wait_reduce(pthread_barrier_t *barrier, int op, pthread_barrier_value_t value,
+                       pthread_barrier_value_t *result)
+{
+  unsigned long phase;
+  long ticket;
+  int res;
+
+  phase = barrier->phase;
+  ticket = ATOMIC_FETCH_ADD(&barrier->tickets, 1, ATOMIC_RELAXED);
+  barrier->slots[ticket] = value;
+
+  res = wait_phase(barrier, op);
+  *result = barrier->result[phase & 1];
+  return res;
+}
+
+
+/*
+ * Split phase wait: the thread arrives and goes on with work that does
+ * not depend on the other threads, then waits for the phase with the
+ * token it got on arrival.  The thread completing the phase does the
+ * whole release in pthread_barrier_arrive_np, and the wait only polls
+ * the phase (see tree_arrive).
+ */
+
+EXTERN int pthread_barrier_arrive_np(pthread_barrier_t *barrier, pthread_barrier_token_t *token)
+{
+  if (!VALID(barrier) || token == NULL) return EINVAL;
+
+  arrive_phase(barrier, NO_REDUCTION, token, 1);
+  return 0;
+}
+
+
+EXTERN int pthread_barrier_wait_token_np(pthread_barrier_t *barrier, pthread_barrier_token_t *token)
+{
+  if (!VALID(barrier) || token == NULL) return EINVAL;
+
+  return wait_token(barrier, token);
+}
+
+
+EXTERN int pthread_barrier_wait_reduce_np(pthread_barrier_t *barrier, 
+                                          int op, long value, long *result)
+{
+  pthread_barrier_value_t v, r;
+  int res;
 
-	if (!VALID(barrier)) return EINVAL;
-	LOCK_CONTROL(barrier);
+  if (!VALID(barrier) || result == NULL) return EINVAL;
+  if (op < PTHREAD_REDUCE_SUM_NP || op > PTHREAD_REDUCE_XOR_NP) return EINVAL;
 
-	barrier->count += 1;
+  v.l = value;
+  res = wait_reduce(barrier, op, v, &r);
+  *result = r.l;
+  return res;
+}
+
+
+EXTERN int pthread_barrier_wait_reducef_np(pthread_barrier_t *barrier, 
+                                           int op, float value, float *result)
+{
+  pthread_barrier_value_t v, r;
+  int res;
 
-//	int myCount = barrier->count;
+  if (!VALID(barrier) || result == NULL) return EINVAL;
+  if (op < PTHREAD_REDUCE_SUM_NP || op > PTHREAD_REDUCE_MAX_NP) return EINVAL;
 
-	if(barrier->count < barrier->neededcount)
-	{
-		UNLOCK_CONTROL(barrier);
-		res = sceKernelWaitSema(barrier->queue, 1, NULL);
-		sceCHECK(res);
-		return 0;
-	}
-	else
-	{
-		barrier->count = 0;
-		if(barrier->neededcount > 1)
-		{
-			res = sceKernelSignalSema(barrier->queue, barrier->neededcount - 1);
-			sceCHECK(res);
-		}
-		UNLOCK_CONTROL(barrier);
-		return PTHREAD_BARRIER_SERIAL_THREAD;
-	}
+  v.f = value;
+  res = wait_reduce(barrier, op | REDUCE_REAL, v, &r);
+  *result = r.f;
+  return res;
 }
 
 
@@ -175,7 +555,53 @@ EXTERN int pthread_barrierattr_destroy(pthread_barrierattr_t *barrierattr)
 
 EXTERN int pthread_barrierattr_init(pthread_barrierattr_t *barrierattr)
 {
-  // Unused parameters
-  (void)&barrierattr;
+  CHECK_PT_PTR(barrierattr);
+
+  barrierattr->type = PTHREAD_BARRIER_CENTRAL_NP;
+  barrierattr->fanin = DEFAULT_FANIN;
+  return 0;
+}
+
+
+EXTERN int pthread_barrierattr_gettype_np(const pthread_barrierattr_t *barrierattr, int *type)
+{
+  CHECK_PT_PTR(barrierattr);
+  CHECK_PT_PTR(type);
+
+  *type = barrierattr->type;
+  return 0;
+}
+
+
+EXTERN int pthread_barrierattr_settype_np(pthread_barrierattr_t *barrierattr, int type)
+{
+  CHECK_PT_PTR(barrierattr);
+
+  if (type != PTHREAD_BARRIER_CENTRAL_NP && type != PTHREAD_BARRIER_TREE_NP)
+    return EINVAL;
+
+  barrierattr->type = type;
+  return 0;
+}
+
+
+EXTERN int pthread_barrierattr_getfanin_np(const pthread_barrierattr_t *barrierattr, int *fanin)
+{
+  CHECK_PT_PTR(barrierattr);
+  CHECK_PT_PTR(fanin);
+
+  *fanin = barrierattr->fanin;
+  return 0;
+}
+
+
+EXTERN int pthread_barrierattr_setfanin_np(pthread_barrierattr_t *barrierattr, int fanin)
+{
+  CHECK_PT_PTR(barrierattr);
+
+  if (fanin < 2 || fanin > MAX_FANIN)
+    return EINVAL;
+
+  barrierattr->fanin = fanin;
   return 0;
 }
@@ -59,9 +59,7 @@ EXTERN int pthread_cond_init(pthread_cond_t *cond,
   
   ENTER_CRITICAL();
 
-  rc = sceKernelCreateSema("pthread cond",
-			   SCE_KERNEL_ATTR_TH_FIFO,
-			   0, 0x7fffffff, NULL);
+  rc = pthread_sema_get_(PTHREAD_SEMA_WAIT_, "pthread cond");
   if (rc > 0) 
     {
       cond->lock = rc;
@@ -84,7 +82,7 @@ EXTERN int pthread_cond_init(pthread_cond_t *cond,
 
 EXTERN int pthread_cond_destroy(pthread_cond_t *cond)
 {
-  int rc, res = 0;
+  int res = 0;
 
   if (!VALID(cond)) return EINVAL;
 
@@ -97,8 +95,7 @@ EXTERN int pthread_cond_destroy(pthread_cond_t *cond)
         {
           DELETE_CONTROL(cond);
 
-          rc = sceKernelDeleteSema(cond->lock);
-          sceCHECK(rc);
+          pthread_sema_put_(PTHREAD_SEMA_WAIT_, cond->lock);
 
           INVALIDATE(cond);
         }
@@ -184,11 +181,11 @@ static int lock(pthread_cond_t *cond, pthread_mutex_t *mutex, SceUInt *time)
   cb.me = me;
   cb.recursivecount = 0;
 
-  if (me->condCBID == INVALID_ID_)
+  if (me->cold.condCBID == INVALID_ID_)
     {
       res = sceKernelCreateCallback("cond callback", 0, CallbackHandler, NULL);
       if (res > 0)
-        me->condCBID = res;
+        me->cold.condCBID = res;
       else
         sceCHECK(res);
     }
@@ -202,7 +199,7 @@ static int lock(pthread_cond_t *cond, pthread_mutex_t *mutex, SceUInt *time)
   TRACE(cond, cond[0]->lock, ">cond WaitSemaCB");
   cond->NbWait++;
 
-  res = sceKernelNotifyCallback(me->condCBID, (int)&cb);
+  res = sceKernelNotifyCallback(me->cold.condCBID, (int)&cb);
   sceCHECK(res);
 
   returncode = 0;
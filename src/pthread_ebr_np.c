@@ -0,0 +1,182 @@
+//Sony Computer Entertainment Confidential
+#include "pthread/include/pthread.h"
+
+/*
+ * Epoch based reclamation after Keir Fraser.  The global epoch moves
+ * forward by steps of 2, the low bit of the thread states marking the
+ * threads inside a critical region.  A thread entering a critical
+ * region publishes the global epoch it saw; the epoch can only move
+ * forward once every thread inside a critical region has seen it.
+ *
+ * A node retired in epoch e was unlinked before any thread could enter
+ * a critical region in epoch e + 2, so once the global epoch reaches
+ * e + 4 no critical region can still hold a reference to it.
+ */
+
+#define ACTIVE          1
+#define BATCH           64      // Retirements between two reclamations
+#define SAFE(e, now)    ((long)((now) - (e)) >= 4)
+
+static volatile unsigned long ebr_epoch = 2;
+
+/* Retired nodes left behind by the threads that exited */
+static pthread_ebr_head_t * volatile ebr_orphans = NULL;
+
+
+EXTERN void pthread_ebr_enter_np(void)
+{
+  pthread_t me = pthread_self();
+
+  if (me->ebr_nesting++ == 0)
+    {
+      ATOMIC_STORE((volatile long *)&me->ebr_state, ebr_epoch | ACTIVE, ATOMIC_RELAXED);
+      // The state must be visible before any protected data is read
+      ATOMIC_FENCE(ATOMIC_SEQ_CST);
+    }
+}
+
+
+EXTERN void pthread_ebr_exit_np(void)
+{
+  pthread_t me = pthread_self();
+
+  if (--me->ebr_nesting == 0)
+    ATOMIC_STORE((volatile long *)&me->ebr_state, 0, ATOMIC_RELEASE);
+}
+
+
+/*
+ * Move the global epoch forward if every thread inside a critical
+ * region has seen it, and return the global epoch.
+ */
+
+static unsigned long advance(void)
+{
+  pthread_t th;
+  unsigned long e, s;
+  int ok = 1;
+
+  e = ATOMIC_LOAD((volatile long *)&ebr_epoch, ATOMIC_SEQ_CST);
+
+  ENTER_CRITICAL();
+  for (th = pthread_list_; th != NULL; th = th->next)
+    {
+      s = th->ebr_state;
+      if ((s & ACTIVE) && (s & ~ACTIVE) != e)
+        {
+          ok = 0;
+          break;
+        }
+    }
+  LEAVE_CRITICAL();
+
+  if (ok)
+    ATOMIC_CAS_EXPLICIT((volatile long *)&ebr_epoch, e, e + 2, ATOMIC_ACQ_REL);
+  return ATOMIC_LOAD((volatile long *)&ebr_epoch, ATOMIC_ACQUIRE);
+}
+
+
+static void run(pthread_ebr_head_t *list)
+{
+  pthread_ebr_head_t *next;
+
+  for (; list != NULL; list = next)
+    {
+      next = list->next;
+      list->func(list);
+    }
+}
+
+
+static void orphan(pthread_ebr_head_t *list)
+{
+  pthread_ebr_head_t *last, *old;
+
+  for (last = list; last->next != NULL; last = last->next)
+    ;
+  do {
+    old = ebr_orphans;
+    last->next = old;
+  } while (ATOMIC_CAS_PTR(&ebr_orphans, old, list, ATOMIC_RELEASE) != old);
+}
+
+
+/*
+ * Free the nodes of the limbo list of th that are safe in epoch now.
+ * The list is ordered newest first, so they are all past the first one.
+ */
+
+static void reclaim(pthread_t th, unsigned long now)
+{
+  pthread_ebr_head_t **link, *list, *next, *young;
+  long n;
+
+  for (link = &th->ebr_limbo, n = 0; *link != NULL; link = &(*link)->next, n++)
+    if (SAFE((*link)->epoch, now))
+      break;
+
+  list = *link;
+  *link = NULL;
+  th->ebr_count = n;
+  run(list);
+
+  // The orphans are in no particular order, the ones not safe yet go
+  // back to the orphan list
+  list = (pthread_ebr_head_t *)ATOMIC_SWAP_PTR(&ebr_orphans, NULL, ATOMIC_ACQUIRE);
+  for (young = NULL; list != NULL; list = next)
+    {
+      next = list->next;
+      if (SAFE(list->epoch, now))
+        list->func(list);
+      else
+        {
+          list->next = young;
+          young = list;
+        }
+    }
+  if (young != NULL)
+    orphan(young);
+}
+
+
+EXTERN int pthread_ebr_retire_np(pthread_ebr_head_t *head,
+                                 void (*func)(pthread_ebr_head_t *))
+{
+  pthread_t me;
+
+  if (head == NULL || func == NULL)
+    return EINVAL;
+
+  me = pthread_self();
+  head->func = func;
+  // Ordered after the unlinking of the node
+  head->epoch = ATOMIC_LOAD((volatile long *)&ebr_epoch, ATOMIC_SEQ_CST);
+  head->next = me->ebr_limbo;
+  me->ebr_limbo = head;
+
+  if (++me->ebr_count % BATCH == 0)
+    reclaim(me, advance());
+  return 0;
+}
+
+
+EXTERN int pthread_ebr_reclaim_np(void)
+{
+  pthread_t me = pthread_self();
+
+  // Two epoch boundaries make everything retired so far safe
+  advance();
+  reclaim(me, advance());
+  return 0;
+}
+
+
+EXTERN void pthread_ebr_release_(pthread_t th)
+{
+  th->ebr_state = 0;
+  th->ebr_nesting = 0;
+  if (th->ebr_limbo != NULL)
+    orphan(th->ebr_limbo);
+  th->ebr_limbo = NULL;
+  th->ebr_count = 0;
+}
@@ -0,0 +1,429 @@
+//Sony Computer Entertainment Confidential
+#include "pthread/include/pthread.h"
+#include <string.h> // memset
+
+/* Common definitions */
+#define VALID(map) \
+	(((map) != 0) && ((map)->table != NULL))
+#define INVALIDATE(map) \
+	do { (map)->table = NULL; } while(0)
+
+#define MIN_BUCKETS     64      // Also the number of stripes
+#define MAX_BUCKETS     (1UL << 28)
+#define MIGRATE_STEP    4       // Buckets migrated by every update
+
+/*
+ * Readers walk the chains without lock, inside an epoch based
+ * reclamation critical region, so that the nodes and tables they see
+ * are not freed under them.  Writers lock the stripe of the key, one
+ * of MIN_BUCKETS locks private to the map.
+ *
+ * The stripe is selected by the low bits of the hash, below the size
+ * of the smallest table: a bucket of the old table and the two buckets
+ * of the new table it splits into are all under the same stripe, which
+ * lets a bucket be migrated while holding a single stripe.
+ *
+ * A bucket is migrated from its tail, one node at a time: the node is
+ * pushed onto its new bucket, then cut from the old chain.  A reader
+ * standing on the node follows it into the new chain, which only adds
+ * nodes to its walk, and a reader arriving later finds the node in the
+ * new table, which is always searched after the old one.
+ */
+
+static inline unsigned long mix(unsigned long h)
+{
+  h ^= h >> 16;
+  h *= 0x45d9f3bUL;
+  h ^= h >> 16;
+  return h;
+}
+
+
+static inline unsigned long hash(const pthread_hashmap_t *map, const void *key)
+{
+  return mix(map->hash != NULL ? map->hash(key) : (unsigned long)key);
+}
+
+
+static inline int equal(const pthread_hashmap_t *map, const pthread_hashmap_node_t *node,
+                        unsigned long h, const void *key)
+{
+  if (node->hash != h)
+    return 0;
+  return map->equal != NULL ? map->equal(node->key, key) : node->key == key;
+}
+
+
+static inline SceKernelLwMutexWork *stripe(const pthread_hashmap_t *map, unsigned long h)
+{
+  return &map->stripes[h & (MIN_BUCKETS - 1)];
+}
+
+
+static inline void lock(SceKernelLwMutexWork *s)
+{
+  int res;
+
+  res = sceKernelLockLwMutex(s, 1, NULL);
+  sceCHECK(res);
+}
+
+
+static inline void unlock(SceKernelLwMutexWork *s)
+{
+  int res;
+
+  res = sceKernelUnlockLwMutex(s, 1);
+  sceCHECK(res);
+}
+
+
+static void delete_stripes(pthread_hashmap_t *map, int n)
+{
+  int res;
+
+  while (n-- > 0)
+    {
+      res = sceKernelDeleteLwMutex(&map->stripes[n]);
+      sceCHECK(res);
+    }
+  PTHREAD_FREE(map->mem);
+}
+
+
+static int create_stripes(pthread_hashmap_t *map)
+{
+  int i, res;
+
+  map->mem = PTHREAD_MALLOC(MIN_BUCKETS * sizeof(SceKernelLwMutexWork) + PTHREAD_CACHELINE_SIZE_ - 1);
+  if (map->mem == NULL)
+    return ENOMEM;
+  map->stripes = (SceKernelLwMutexWork *)
+    (((unsigned long)map->mem + PTHREAD_CACHELINE_SIZE_ - 1) & ~(PTHREAD_CACHELINE_SIZE_ - 1));
+  memset(map->stripes, 0, MIN_BUCKETS * sizeof(SceKernelLwMutexWork));
+
+  for (i = 0; i < MIN_BUCKETS; i++)
+    {
+      res = sceKernelCreateLwMutex(&map->stripes[i], "pthread hashmap",
+                                   SCE_KERNEL_LW_MUTEX_ATTR_TH_FIFO, 0, NULL);
+      if (res < 0)
+        {
+          sceCHECK(res);
+          delete_stripes(map, i);
+          return ERROR_errno_sce(res);
+        }
+    }
+  return 0;
+}
+
+
+static pthread_hashmap_table_t *new_table(unsigned long n)
+{
+  pthread_hashmap_table_t *t;
+
+  t = (pthread_hashmap_table_t *)PTHREAD_MALLOC(sizeof(pthread_hashmap_table_t)
+                                                + n * sizeof(pthread_hashmap_node_t *));
+  if (t == NULL)
+    return NULL;
+  t->buckets = (pthread_hashmap_node_t * volatile *)(t + 1);
+  memset((void *)t->buckets, 0, n * sizeof(pthread_hashmap_node_t *));
+  t->mask = n - 1;
+  t->next = NULL;
+  t->migrate = 0;
+  t->migrated = 0;
+  return t;
+}
+
+
+static void free_table(pthread_ebr_head_t *head)
+{
+  PTHREAD_FREE(head);
+}
+
+
+static void free_node(pthread_ebr_head_t *head)
+{
+  PTHREAD_FREE(head);
+}
+
+
+EXTERN int pthread_hashmap_destroy_np(pthread_hashmap_t *map)
+{
+  pthread_hashmap_table_t *t, *nt;
+  pthread_hashmap_node_t *n, *next;
+  unsigned long i;
+
+  if (!VALID(map)) return EINVAL;
+
+  for (t = map->table; t != NULL; t = nt)
+    {
+      for (i = 0; i <= t->mask; i++)
+        for (n = t->buckets[i]; n != NULL; n = next)
+          {
+            next = n->next;
+            PTHREAD_FREE(n);
+          }
+      nt = t->next;
+      PTHREAD_FREE(t);
+    }
+  delete_stripes(map, MIN_BUCKETS);
+  INVALIDATE(map);
+  return 0;
+}
+
+
+/*
+ * The map starts with size buckets, rounded up to a power of two, and
+ * doubles whenever it holds more elements than buckets.  NULL hash and
+ * equal functions compare the keys as integers.
+ */
+
+EXTERN int pthread_hashmap_init_np(pthread_hashmap_t *map, unsigned int size,
+                                   unsigned long (*hashfn)(const void *key),
+                                   int (*equalfn)(const void *a, const void *b))
+{
+  unsigned long n;
+  int res;
+
+  CHECK_PT_PTR(map);
+  if (size > MAX_BUCKETS)
+    return EINVAL;
+
+  for (n = MIN_BUCKETS; n < size; n <<= 1)
+    ;
+
+  res = create_stripes(map);
+  if (res != 0)
+    {
+      INVALIDATE(map);
+      return res;
+    }
+  map->table = new_table(n);
+  if (map->table == NULL)
+    {
+      delete_stripes(map, MIN_BUCKETS);
+      return ENOMEM;
+    }
+  map->hash = hashfn;
+  map->equal = equalfn;
+  map->count = 0;
+  return 0;
+}
+
+
+/*
+ * Move bucket i of t into nt.  Called with the stripe of the bucket.
+ */
+
+static void migrate_bucket(pthread_hashmap_table_t *t, pthread_hashmap_table_t *nt, unsigned long i)
+{
+  pthread_hashmap_node_t * volatile *link, * volatile *b;
+  pthread_hashmap_node_t *tail;
+
+  while (t->buckets[i] != NULL)
+    {
+      for (link = &t->buckets[i]; (*link)->next != NULL; link = &(*link)->next)
+        ;
+      tail = *link;
+      b = &nt->buckets[tail->hash & nt->mask];
+      ATOMIC_STORE_PTR(&tail->next, *b, ATOMIC_RELAXED);
+      ATOMIC_STORE_PTR(b, tail, ATOMIC_RELEASE);
+      ATOMIC_STORE_PTR(link, NULL, ATOMIC_RELEASE);
+    }
+}
+
+
+/*
+ * Migrate a few buckets of the table being resized, if any.  The last
+ * thread to complete a bucket retires the old table.
+ */
+
+static void migrate(pthread_hashmap_t *map)
+{
+  pthread_hashmap_table_t *t, *nt;
+  unsigned long i;
+  int k;
+
+  pthread_ebr_enter_np();
+  t = (pthread_hashmap_table_t *)ATOMIC_LOAD_PTR(&map->table, ATOMIC_ACQUIRE);
+  nt = (pthread_hashmap_table_t *)ATOMIC_LOAD_PTR(&t->next, ATOMIC_ACQUIRE);
+
+  for (k = 0; nt != NULL && k < MIGRATE_STEP; k++)
+    {
+      i = ATOMIC_FETCH_ADD(&t->migrate, 1, ATOMIC_RELAXED);
+      if (i > t->mask)
+        break;
+
+      lock(stripe(map, i));
+      migrate_bucket(t, nt, i);
+      unlock(stripe(map, i));
+
+      if ((unsigned long)ATOMIC_FETCH_ADD(&t->migrated, 1, ATOMIC_ACQ_REL) == t->mask)
+        {
+          ATOMIC_STORE_PTR(&map->table, nt, ATOMIC_RELEASE);
+          pthread_ebr_retire_np(&t->ebr, free_table);
+          break;
+        }
+    }
+  pthread_ebr_exit_np();
+}
+
+
+/*
+ * Start a migration into a table twice as large, unless one is going
+ * on already.
+ */
+
+static void grow(pthread_hashmap_t *map)
+{
+  pthread_hashmap_table_t *t, *nt;
+
+  pthread_ebr_enter_np();
+  t = (pthread_hashmap_table_t *)ATOMIC_LOAD_PTR(&map->table, ATOMIC_ACQUIRE);
+  if (t->next == NULL && t->mask + 1 < MAX_BUCKETS)
+    {
+      // On failure, tried again on the next insertion
+      nt = new_table((t->mask + 1) * 2);
+      if (nt != NULL && ATOMIC_CAS_PTR(&t->next, NULL, nt, ATOMIC_RELEASE) != NULL)
+        PTHREAD_FREE(nt);
+    }
+  pthread_ebr_exit_np();
+}
+
+
+/*
+ * Search key in all the tables.  Returns the node, or NULL, and the
+ * link to the node in *linkp.
+ */
+
+static pthread_hashmap_node_t *find(pthread_hashmap_t *map, unsigned long h, const void *key,
+                                    pthread_hashmap_node_t * volatile **linkp)
+{
+  pthread_hashmap_table_t *t;
+  pthread_hashmap_node_t * volatile *link;
+  pthread_hashmap_node_t *n;
+
+  for (t = (pthread_hashmap_table_t *)ATOMIC_LOAD_PTR(&map->table, ATOMIC_ACQUIRE);
+       t != NULL;
+       t = (pthread_hashmap_table_t *)ATOMIC_LOAD_PTR(&t->next, ATOMIC_ACQUIRE))
+    {
+      link = &t->buckets[h & t->mask];
+      for (n = (pthread_hashmap_node_t *)ATOMIC_LOAD_PTR(link, ATOMIC_ACQUIRE);
+           n != NULL;
+           n = (pthread_hashmap_node_t *)ATOMIC_LOAD_PTR(link, ATOMIC_ACQUIRE))
+        {
+          if (equal(map, n, h, key))
+            {
+              if (linkp != NULL)
+                *linkp = link;
+              return n;
+            }
+          link = &n->next;
+        }
+    }
+  return NULL;
+}
+
+
+EXTERN int pthread_hashmap_lookup_np(pthread_hashmap_t *map, const void *key, void **value)
+{
+  pthread_hashmap_node_t *node;
+  int res = ENOENT;
+
+  if (!VALID(map) || value == NULL) return EINVAL;
+
+  pthread_ebr_enter_np();
+  node = find(map, hash(map, key), key, NULL);
+  if (node != NULL)
+    {
+      *value = node->value;
+      res = 0;
+    }
+  pthread_ebr_exit_np();
+  return res;
+}
+
+
+EXTERN int pthread_hashmap_insert_np(pthread_hashmap_t *map, const void *key, void *value)
+{
+  pthread_hashmap_table_t *t;
+  pthread_hashmap_node_t *node, * volatile *b;
+  unsigned long h, size;
+
+  if (!VALID(map)) return EINVAL;
+
+  migrate(map);
+
+  node = (pthread_hashmap_node_t *)PTHREAD_MALLOC(sizeof(pthread_hashmap_node_t));
+  if (node == NULL)
+    return ENOMEM;
+  h = hash(map, key);
+  node->hash = h;
+  node->key = key;
+  node->value = value;
+
+  lock(stripe(map, h));
+  pthread_ebr_enter_np();
+  if (find(map, h, key, NULL) != NULL)
+    {
+      pthread_ebr_exit_np();
+      unlock(stripe(map, h));
+      PTHREAD_FREE(node);
+      return EEXIST;
+    }
+
+  // Insert into the newest table, the stripe keeps its bucket from
+  // being migrated meanwhile
+  for (t = map->table; t->next != NULL; t = t->next)
+    ;
+  b = &t->buckets[h & t->mask];
+  node->next = *b;
+  ATOMIC_STORE_PTR(b, node, ATOMIC_RELEASE);
+  size = t->mask + 1;
+  pthread_ebr_exit_np();
+  unlock(stripe(map, h));
+
+  if ((unsigned long)ATOMIC_FETCH_ADD(&map->count, 1, ATOMIC_RELAXED) >= size)
+    grow(map);
+  return 0;
+}
+
+
+EXTERN int pthread_hashmap_remove_np(pthread_hashmap_t *map, const void *key, void **value)
+{
+  pthread_hashmap_node_t *node, * volatile *link;
+  unsigned long h;
+
+  if (!VALID(map)) return EINVAL;
+
+  migrate(map);
+
+  h = hash(map, key);
+  lock(stripe(map, h));
+  pthread_ebr_enter_np();
+  node = find(map, h, key, &link);
+  if (node == NULL)
+    {
+      pthread_ebr_exit_np();
+      unlock(stripe(map, h));
+      return ENOENT;
+    }
+  // Readers standing on the node go on through its next field
+  ATOMIC_STORE_PTR(link, node->next, ATOMIC_RELEASE);
+  pthread_ebr_exit_np();
+  unlock(stripe(map, h));
+
+  ATOMIC_FETCH_ADD(&map->count, -1, ATOMIC_RELAXED);
+  if (value != NULL)
+    *value = node->value;
+  pthread_ebr_retire_np(&node->ebr, free_node);
+  return 0;
+}
+
+
+EXTERN unsigned long pthread_hashmap_count_np(pthread_hashmap_t *map)
+{
+  if (!VALID(map)) return 0;
+
+  return (unsigned long)map->count;
+}
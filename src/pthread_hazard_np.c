@@ -0,0 +1,261 @@
+//Sony Computer Entertainment Confidential
+#include "pthread/include/pthread.h"
+#include <string.h> // memset
+
+/*
+ * Hazard pointers after Maged Michael: a reader announces the node it
+ * is about to dereference in one of its hazard pointers, then checks
+ * that the node is still reachable.  A node removed from its structure
+ * is retired instead of freed, and only freed by a scan which found no
+ * hazard pointer on it.
+ *
+ * A thread scans its retire list once it holds twice as many nodes as
+ * there are hazard pointers, so that every scan frees at least half of
+ * them and the cost of a scan is spread over the retirements.  The
+ * retire list of an exiting thread is adopted by the next scan of any
+ * thread.
+ */
+
+static pthread_hazard_rec_t * volatile hazard_recs = NULL;
+static volatile long hazard_nrecs = 0;
+
+/* Retired nodes left behind by the threads that exited */
+static pthread_hazard_head_t * volatile hazard_orphans = NULL;
+
+
+EXTERN int pthread_hazard_acquire_(pthread_t th)
+{
+  pthread_hazard_rec_t *rec, *old;
+
+  for (rec = (pthread_hazard_rec_t *)ATOMIC_LOAD_PTR(&hazard_recs, ATOMIC_ACQUIRE); rec != NULL; rec = rec->next)
+    {
+      if (rec->active == 0 && ATOMIC_CAS_EXPLICIT(&rec->active, 0, 1, ATOMIC_ACQUIRE) == 0)
+        {
+          th->hazard = rec;
+          return 0;
+        }
+    }
+
+  rec = (pthread_hazard_rec_t *)PTHREAD_MALLOC(sizeof(pthread_hazard_rec_t));
+  if (rec == NULL)
+    return ENOMEM;
+  memset(rec, 0, sizeof(pthread_hazard_rec_t));
+  rec->active = 1;
+
+  do {
+    old = hazard_recs;
+    rec->next = old;
+  } while (ATOMIC_CAS_PTR(&hazard_recs, old, rec, ATOMIC_RELEASE) != old);
+  ATOMIC_FETCH_ADD(&hazard_nrecs, 1, ATOMIC_RELAXED);
+
+  th->hazard = rec;
+  return 0;
+}
+
+
+static pthread_hazard_rec_t *record(void)
+{
+  pthread_t me = pthread_self();
+
+  if (me->hazard == NULL)
+    pthread_hazard_acquire_(me);
+  return me->hazard;
+}
+
+
+static int compare(const void *a, const void *b)
+{
+  unsigned long x = *(const unsigned long *)a;
+  unsigned long y = *(const unsigned long *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+
+/*
+ * Free the nodes retired by rec that no hazard pointer protects.  The
+ * hazard pointers are copied and sorted first, so that the scan costs
+ * O(R log H) for R retired nodes and H hazard pointers.
+ */
+
+static int scan(pthread_hazard_rec_t *rec)
+{
+  pthread_hazard_rec_t *r, *first;
+  pthread_hazard_head_t *list, *node, *next, *freed;
+  unsigned long *hp, p;
+  long n, i, kept;
+
+  if (rec->scanning)
+    return 0;                   // Called from a callback of this scan
+
+  // Adopt the orphans
+  list = (pthread_hazard_head_t *)ATOMIC_SWAP_PTR(&hazard_orphans, NULL, ATOMIC_ACQUIRE);
+  while (list != NULL)
+    {
+      next = list->next;
+      list->next = rec->retired;
+      rec->retired = list;
+      rec->nretired++;
+      list = next;
+    }
+  if (rec->retired == NULL)
+    return 0;
+
+  // The removal of the retired nodes must be visible before the
+  // hazard pointers are read
+  ATOMIC_FENCE(ATOMIC_SEQ_CST);
+
+  // Records added after this point belong to threads that cannot reach
+  // the retired nodes any more
+  first = (pthread_hazard_rec_t *)ATOMIC_LOAD_PTR(&hazard_recs, ATOMIC_ACQUIRE);
+  for (n = 0, r = first; r != NULL; r = r->next)
+    n += PTHREAD_HAZARDS_;
+
+  hp = (unsigned long *)PTHREAD_MALLOC(n * sizeof(unsigned long));
+  if (hp == NULL)
+    return ENOMEM;              // Retried on the next retirement
+
+  for (n = 0, r = first; r != NULL; r = r->next)
+    for (i = 0; i < PTHREAD_HAZARDS_; i++)
+      {
+        p = (unsigned long)ATOMIC_LOAD_PTR(&r->hazard[i], ATOMIC_RELAXED);
+        if (p != 0)
+          hp[n++] = p;
+      }
+  qsort(hp, n, sizeof(unsigned long), compare);
+
+  list = rec->retired;
+  rec->retired = NULL;
+  freed = NULL;
+  kept = 0;
+  for (node = list; node != NULL; node = next)
+    {
+      next = node->next;
+      p = (unsigned long)node->ptr;
+      if (n > 0 && bsearch(&p, hp, n, sizeof(unsigned long), compare) != NULL)
+        {
+          node->next = rec->retired;
+          rec->retired = node;
+          kept++;
+        }
+      else
+        {
+          node->next = freed;
+          freed = node;
+        }
+    }
+  rec->nretired = kept;
+  PTHREAD_FREE(hp);
+
+  // The callbacks run once the record is consistent, they may retire
+  // more nodes
+  rec->scanning = 1;
+  for (node = freed; node != NULL; node = next)
+    {
+      next = node->next;
+      node->func(node);
+    }
+  rec->scanning = 0;
+  return 0;
+}
+
+
+EXTERN void pthread_hazard_release_(pthread_t th)
+{
+  pthread_hazard_rec_t *rec = th->hazard;
+  pthread_hazard_head_t *last, *old;
+  int i;
+
+  if (rec == NULL)
+    return;
+
+  for (i = 0; i < PTHREAD_HAZARDS_; i++)
+    ATOMIC_STORE_PTR(&rec->hazard[i], NULL, ATOMIC_RELEASE);
+
+  scan(rec);
+  if (rec->retired != NULL)
+    {
+      for (last = rec->retired; last->next != NULL; last = last->next)
+        ;
+      do {
+        old = hazard_orphans;
+        last->next = old;
+      } while (ATOMIC_CAS_PTR(&hazard_orphans, old, rec->retired, ATOMIC_RELEASE) != old);
+      rec->retired = NULL;
+      rec->nretired = 0;
+    }
+
+  th->hazard = NULL;
+  ATOMIC_STORE(&rec->active, 0, ATOMIC_RELEASE);
+}
+
+
+EXTERN int pthread_hazard_protect_np(int slot, void * volatile *src, void **ptr)
+{
+  pthread_hazard_rec_t *rec;
+  void *p;
+
+  if (slot < 0 || slot >= PTHREAD_HAZARDS_ || src == NULL || ptr == NULL) return EINVAL;
+
+  rec = record();
+  if (rec == NULL)
+    return ENOMEM;
+
+  p = ATOMIC_LOAD_PTR(src, ATOMIC_RELAXED);
+  for (;;)
+    {
+      ATOMIC_STORE_PTR(&rec->hazard[slot], p, ATOMIC_RELAXED);
+      // The hazard pointer must be visible before src is read again
+      ATOMIC_FENCE(ATOMIC_SEQ_CST);
+      if (ATOMIC_LOAD_PTR(src, ATOMIC_ACQUIRE) == p)
+        break;
+      p = ATOMIC_LOAD_PTR(src, ATOMIC_RELAXED);
+    }
+  *ptr = p;
+  return 0;
+}
+
+
+EXTERN int pthread_hazard_clear_np(int slot)
+{
+  pthread_t me = pthread_self();
+
+  if (slot < 0 || slot >= PTHREAD_HAZARDS_) return EINVAL;
+
+  if (me->hazard != NULL)
+    ATOMIC_STORE_PTR(&me->hazard->hazard[slot], NULL, ATOMIC_RELEASE);
+  return 0;
+}
+
+
+EXTERN int pthread_hazard_retire_np(pthread_hazard_head_t *head, const void *ptr,
+                                    void (*func)(pthread_hazard_head_t *))
+{
+  pthread_hazard_rec_t *rec;
+
+  if (head == NULL || func == NULL)
+    return EINVAL;
+
+  rec = record();
+  if (rec == NULL)
+    return ENOMEM;
+
+  head->func = func;
+  head->ptr = ptr;
+  head->next = rec->retired;
+  rec->retired = head;
+  if (++rec->nretired >= 2 * PTHREAD_HAZARDS_ * hazard_nrecs)
+    scan(rec);
+  return 0;
+}
+
+
+EXTERN int pthread_hazard_scan_np(void)
+{
+  pthread_hazard_rec_t *rec;
+
+  rec = record();
+  if (rec == NULL)
+    return ENOMEM;
+  return scan(rec);
+}
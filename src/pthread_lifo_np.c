@@ -0,0 +1,93 @@
+//Sony Computer Entertainment Confidential
+#include "pthread/include/pthread.h"
+
+/* Head packing: the pointer in the low half, the tag in the high half */
+#if defined(__LP64__)
+# define TOP(head)          ((pthread_lifo_node_t *)(uintptr_t)(uint64_t)(head))
+# define TAG(head)          ((uint64_t)((head) >> 64))
+# define HEAD(top, tag)     (((pthread_lifo_head_t)(uint64_t)(tag) << 64) | (uint64_t)(uintptr_t)(top))
+# define LOAD_HEAD          ATOMIC_LOAD128
+# define CAS_HEAD           ATOMIC_CAS128
+#else
+# define TOP(head)          ((pthread_lifo_node_t *)(uintptr_t)(uint32_t)(head))
+# define TAG(head)          ((uint32_t)((uint64_t)(head) >> 32))
+# define HEAD(top, tag)     ((int64_t)(((uint64_t)(tag) << 32) | (uint32_t)(uintptr_t)(top)))
+# define LOAD_HEAD          ATOMIC_LOAD64
+# define CAS_HEAD           ATOMIC_CAS64
+#endif
+
+
+EXTERN int pthread_lifo_init_np(pthread_lifo_t *lifo)
+{
+  CHECK_PT_PTR(lifo);
+  lifo->head = 0;
+  return 0;
+}
+
+
+/*
+ * Every update bumps the tag, so a compare and swap based on a head
+ * read before a concurrent pop and push of the same node fails.
+ */
+
+EXTERN void pthread_lifo_push_chain_np(pthread_lifo_t *lifo, 
+                                       pthread_lifo_node_t *first,
+                                       pthread_lifo_node_t *last)
+{
+  pthread_lifo_head_t old, cur;
+
+  old = LOAD_HEAD(&lifo->head, ATOMIC_RELAXED);
+  for (;;)
+    {
+      last->next = TOP(old);
+      cur = CAS_HEAD(&lifo->head, old, HEAD(first, TAG(old) + 1), ATOMIC_RELEASE);
+      if (cur == old)
+        break;
+      old = cur;
+    }
+}
+
+
+EXTERN void pthread_lifo_push_np(pthread_lifo_t *lifo, pthread_lifo_node_t *node)
+{
+  pthread_lifo_push_chain_np(lifo, node, node);
+}
+
+
+EXTERN pthread_lifo_node_t *pthread_lifo_pop_np(pthread_lifo_t *lifo)
+{
+  pthread_lifo_node_t *top;
+  pthread_lifo_head_t old, cur;
+
+  old = LOAD_HEAD(&lifo->head, ATOMIC_ACQUIRE);
+  for (;;)
+    {
+      top = TOP(old);
+      if (top == NULL)
+        return NULL;
+      // top may be popped meanwhile, the tag then makes the CAS fail
+      cur = CAS_HEAD(&lifo->head, old, HEAD(top->next, TAG(old) + 1), ATOMIC_ACQ_REL);
+      if (cur == old)
+        break;
+      old = cur;
+    }
+  return top;
+}
+
+
+EXTERN pthread_lifo_node_t *pthread_lifo_pop_all_np(pthread_lifo_t *lifo)
+{
+  pthread_lifo_head_t old, cur;
+
+  old = LOAD_HEAD(&lifo->head, ATOMIC_ACQUIRE);
+  for (;;)
+    {
+      if (TOP(old) == NULL)
+        return NULL;
+      cur = CAS_HEAD(&lifo->head, old, HEAD(NULL, TAG(old) + 1), ATOMIC_ACQ_REL);
+      if (cur == old)
+        break;
+      old = cur;
+    }
+  return TOP(old);
+}
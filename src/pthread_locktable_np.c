@@ -0,0 +1,221 @@
+//Sony Computer Entertainment Confidential
+#include "pthread/include/pthread.h"
+#include <string.h> // memset
+
+/* Common definitions */
+#define VALID(table) \
+	(((table) != 0) && ((table)->stripes != NULL))
+#define INVALIDATE(table) \
+	do { (table)->stripes = NULL; } while(0)
+
+#define MAX_STRIPES   65536
+
+/*
+ * Fibonacci hashing of the object address: the multiplication spreads
+ * the low order bits, which are mostly alignment, into the high order
+ * bits that select the stripe.
+ */
+
+static inline SceKernelLwMutexWork *stripe(const pthread_locktable_t *table, const void *addr)
+{
+  unsigned long h = (unsigned long)addr * 2654435761UL;
+  return &table->stripes[h >> table->shift];
+}
+
+
+EXTERN int pthread_locktable_destroy_np(pthread_locktable_t *table)
+{
+  unsigned int i, count;
+  int res;
+
+  if (!VALID(table)) return EINVAL;
+
+  count = 1U << (32 - table->shift);
+  for (i = 0; i < count; i++)
+    {
+      res = sceKernelDeleteLwMutex(&table->stripes[i]);
+      sceCHECK(res);
+    }
+
+  PTHREAD_FREE(table->mem);
+  INVALIDATE(table);
+  return 0;
+}
+
+
+/*
+ * The lock table is sized to count stripes, rounded up to a power of
+ * two.  A count of 0 selects PTHREAD_LOCKTABLE_DEFAULT_NP.
+ */
+
+EXTERN int pthread_locktable_init_np(pthread_locktable_t *table, unsigned int count)
+{
+  unsigned int i, n, shift;
+  int res;
+
+  CHECK_PT_PTR(table);
+
+  if (count == 0)
+    count = PTHREAD_LOCKTABLE_DEFAULT_NP;
+  if (count > MAX_STRIPES)
+    return EINVAL;
+
+  for (n = 2, shift = 31; n < count; n <<= 1, shift--)
+    ;
+
+  table->mem = PTHREAD_MALLOC(n * sizeof(SceKernelLwMutexWork) + PTHREAD_CACHELINE_SIZE_ - 1);
+  if (table->mem == NULL)
+    {
+      INVALIDATE(table);
+      return ENOMEM;
+    }
+  table->stripes = (SceKernelLwMutexWork *)
+    (((unsigned long)table->mem + PTHREAD_CACHELINE_SIZE_ - 1) & ~(PTHREAD_CACHELINE_SIZE_ - 1));
+  table->shift = shift;
+  memset(table->stripes, 0, n * sizeof(SceKernelLwMutexWork));
+
+  for (i = 0; i < n; i++)
+    {
+      res = sceKernelCreateLwMutex(&table->stripes[i], "pthread locktable",
+                                   SCE_KERNEL_LW_MUTEX_ATTR_TH_FIFO | SCE_KERNEL_LW_MUTEX_ATTR_RECURSIVE,
+                                   0, NULL);
+      if (res < 0)
+        {
+          sceCHECK(res);
+          while (i-- > 0)
+            sceKernelDeleteLwMutex(&table->stripes[i]);
+          PTHREAD_FREE(table->mem);
+          INVALIDATE(table);
+          return ERROR_errno_sce(res);
+        }
+    }
+
+  return 0;
+}
+
+
+EXTERN int pthread_locktable_lock_np(pthread_locktable_t *table, const void *addr)
+{
+  int res;
+
+  if (!VALID(table)) return EINVAL;
+
+  res = sceKernelLockLwMutex(stripe(table, addr), 1, NULL);
+  if (res == SCE_OK)
+    return 0;
+  sceCHECK(res);
+  return EINVAL;
+}
+
+
+EXTERN int pthread_locktable_trylock_np(pthread_locktable_t *table, const void *addr)
+{
+  int res;
+
+  if (!VALID(table)) return EINVAL;
+
+  res = sceKernelTryLockLwMutex(stripe(table, addr), 1);
+  if (res == SCE_OK)
+    return 0;
+  else if (res == (int)SCE_KERNEL_ERROR_LW_MUTEX_FAILED_TO_OWN)
+    return EBUSY;
+  return EINVAL;
+}
+
+
+EXTERN int pthread_locktable_unlock_np(pthread_locktable_t *table, const void *addr)
+{
+  int res;
+
+  if (!VALID(table)) return EINVAL;
+
+  res = sceKernelUnlockLwMutex(stripe(table, addr), 1);
+  if (res == SCE_OK)
+    return 0;
+  return EPERM;
+}
+
+
+/*
+ * Returns the lowest stripe above 'after' covering one of the n
+ * addresses, or NULL when there is none left.  Walking the stripes in
+ * address order gives every thread the same acquisition order, and
+ * naturally skips addresses sharing a stripe.
+ */
+
+static SceKernelLwMutexWork *next_stripe(const pthread_locktable_t *table,
+                                         const void * const *addrs, int n,
+                                         const SceKernelLwMutexWork *after)
+{
+  SceKernelLwMutexWork *s, *best = NULL;
+  int i;
+
+  for (i = 0; i < n; i++)
+    {
+      s = stripe(table, addrs[i]);
+      if (s > after && (best == NULL || s < best))
+        best = s;
+    }
+  return best;
+}
+
+
+static SceKernelLwMutexWork *prev_stripe(const pthread_locktable_t *table,
+                                         const void * const *addrs, int n,
+                                         const SceKernelLwMutexWork *before)
+{
+  SceKernelLwMutexWork *s, *best = NULL;
+  int i;
+
+  for (i = 0; i < n; i++)
+    {
+      s = stripe(table, addrs[i]);
+      if (s < before && (best == NULL || s > best))
+        best = s;
+    }
+  return best;
+}
+
+
+EXTERN int pthread_locktable_lock_many_np(pthread_locktable_t *table,
+                                          const void * const *addrs, int n)
+{
+  SceKernelLwMutexWork *s, *held;
+  int res;
+
+  if (!VALID(table) || addrs == NULL || n < 0) return EINVAL;
+
+  for (s = next_stripe(table, addrs, n, NULL); s != NULL; s = next_stripe(table, addrs, n, s))
+    {
+      res = sceKernelLockLwMutex(s, 1, NULL);
+      if (res != SCE_OK)
+        {
+          sceCHECK(res);
+          // Release what we got so far
+          for (held = prev_stripe(table, addrs, n, s); held != NULL; held = prev_stripe(table, addrs, n, held))
+            sceKernelUnlockLwMutex(held, 1);
+          return EINVAL;
+        }
+    }
+  return 0;
+}
+
+
+EXTERN int pthread_locktable_unlock_many_np(pthread_locktable_t *table,
+                                            const void * const *addrs, int n)
+{
+  SceKernelLwMutexWork *s;
+  int res, ret = 0;
+
+  if (!VALID(table) || addrs == NULL || n < 0) return EINVAL;
+
+  for (s = prev_stripe(table, addrs, n, &table->stripes[1U << (32 - table->shift)]);
+       s != NULL;
+       s = prev_stripe(table, addrs, n, s))
+    {
+      res = sceKernelUnlockLwMutex(s, 1);
+      if (res != SCE_OK)
+        ret = EPERM;
+    }
+  return ret;
+}
@@ -0,0 +1,213 @@
+//Sony Computer Entertainment Confidential
+#include "pthread/include/pthread.h"
+
+/* Common definitions */
+#define VALID(q) \
+	(((q) != 0) && ((q)->cells != NULL))
+#define INVALIDATE(q) \
+	do { (q)->cells = NULL; } while(0)
+
+#define MAX_CELLS   (1UL << 30)
+
+/*
+ * Bounded queue after Dmitry Vyukov: every cell carries the position
+ * it is ready for, pos when it is free for the push at pos, pos + 1
+ * when it holds the element for the pop at pos.  Producers and
+ * consumers claim a position with a compare and swap on their own
+ * index, and never touch the index of the other side.
+ */
+
+EXTERN int pthread_mpmcq_destroy_np(pthread_mpmcq_t *q)
+{
+  if (!VALID(q)) return EINVAL;
+
+  pthread_waitq_destroy_(&q->notfull);
+  pthread_waitq_destroy_(&q->notempty);
+  PTHREAD_FREE(q->cells);
+  INVALIDATE(q);
+  return 0;
+}
+
+
+EXTERN int pthread_mpmcq_init_np(pthread_mpmcq_t *q, unsigned int size)
+{
+  unsigned long i, n;
+  int res;
+
+  CHECK_PT_PTR(q);
+  if (size < 1 || size > MAX_CELLS)
+    return EINVAL;
+
+  for (n = 2; n < size; n <<= 1)
+    ;
+
+  q->cells = (pthread_mpmcq_cell_t *)PTHREAD_MALLOC(n * sizeof(pthread_mpmcq_cell_t));
+  if (q->cells == NULL)
+    return ENOMEM;
+  for (i = 0; i < n; i++)
+    {
+      q->cells[i].seq = i;
+      q->cells[i].data = NULL;
+    }
+  q->mask = n - 1;
+  q->enqueue = 0;
+  q->dequeue = 0;
+
+  res = pthread_waitq_init_(&q->notempty, "pthread mpmcq (e)");
+  if (res == 0)
+    {
+      res = pthread_waitq_init_(&q->notfull, "pthread mpmcq (f)");
+      if (res != 0)
+        pthread_waitq_destroy_(&q->notempty);
+    }
+  if (res != 0)
+    {
+      PTHREAD_FREE(q->cells);
+      INVALIDATE(q);
+    }
+  return res;
+}
+
+
+static int push(pthread_mpmcq_t *q, void *data)
+{
+  pthread_mpmcq_cell_t *cell;
+  unsigned long pos, seq, cur;
+
+  pos = q->enqueue;
+  for (;;)
+    {
+      cell = &q->cells[pos & q->mask];
+      seq = ATOMIC_LOAD((volatile long *)&cell->seq, ATOMIC_ACQUIRE);
+      if (seq == pos)
+        {
+          cur = ATOMIC_CAS_EXPLICIT((volatile long *)&q->enqueue, pos, pos + 1, ATOMIC_RELAXED);
+          if (cur == pos)
+            break;
+          pos = cur;
+        }
+      else if ((long)(seq - pos) < 0)
+        return EAGAIN;          // Full: the cell still holds the element of the previous lap
+      else
+        pos = q->enqueue;
+    }
+
+  cell->data = data;
+  ATOMIC_STORE((volatile long *)&cell->seq, pos + 1, ATOMIC_RELEASE);
+  return 0;
+}
+
+
+static int pop(pthread_mpmcq_t *q, void **data)
+{
+  pthread_mpmcq_cell_t *cell;
+  unsigned long pos, seq, cur;
+
+  pos = q->dequeue;
+  for (;;)
+    {
+      cell = &q->cells[pos & q->mask];
+      seq = ATOMIC_LOAD((volatile long *)&cell->seq, ATOMIC_ACQUIRE);
+      if (seq == pos + 1)
+        {
+          cur = ATOMIC_CAS_EXPLICIT((volatile long *)&q->dequeue, pos, pos + 1, ATOMIC_RELAXED);
+          if (cur == pos)
+            break;
+          pos = cur;
+        }
+      else if ((long)(seq - (pos + 1)) < 0)
+        return EAGAIN;          // Empty: the cell has not been filled for this lap
+      else
+        pos = q->dequeue;
+    }
+
+  *data = cell->data;
+  ATOMIC_STORE((volatile long *)&cell->seq, pos + q->mask + 1, ATOMIC_RELEASE);
+  return 0;
+}
+
+
+EXTERN int pthread_mpmcq_trypush_np(pthread_mpmcq_t *q, void *data)
+{
+  int res;
+
+  if (!VALID(q)) return EINVAL;
+
+  res = push(q, data);
+  if (res == 0)
+    pthread_waitq_wake_(&q->notempty);
+  return res;
+}
+
+
+EXTERN int pthread_mpmcq_trypop_np(pthread_mpmcq_t *q, void **data)
+{
+  int res;
+
+  if (!VALID(q) || data == NULL) return EINVAL;
+
+  res = pop(q, data);
+  if (res == 0)
+    pthread_waitq_wake_(&q->notfull);
+  return res;
+}
+
+
+/*
+ * The blocking versions register as waiters before trying again, so
+ * that an element pushed (or popped) after the first failed attempt
+ * either is seen by the second one, or wakes the thread up.
+ */
+
+EXTERN int pthread_mpmcq_push_np(pthread_mpmcq_t *q, void *data)
+{
+  int res;
+
+  if (!VALID(q)) return EINVAL;
+
+  for (;;)
+    {
+      if (push(q, data) == 0)
+        break;
+
+      pthread_waitq_prepare_(&q->notfull);
+      if (push(q, data) == 0)
+        {
+          pthread_waitq_cancel_(&q->notfull);
+          break;
+        }
+      res = pthread_waitq_wait_(&q->notfull, NULL);
+      if (res != 0)
+        return res;
+    }
+
+  pthread_waitq_wake_(&q->notempty);
+  return 0;
+}
+
+
+EXTERN int pthread_mpmcq_pop_np(pthread_mpmcq_t *q, void **data)
+{
+  int res;
+
+  if (!VALID(q) || data == NULL) return EINVAL;
+
+  for (;;)
+    {
+      if (pop(q, data) == 0)
+        break;
+
+      pthread_waitq_prepare_(&q->notempty);
+      if (pop(q, data) == 0)
+        {
+          pthread_waitq_cancel_(&q->notempty);
+          break;
+        }
+      res = pthread_waitq_wait_(&q->notempty, NULL);
+      if (res != 0)
+        return res;
+    }
+
+  pthread_waitq_wake_(&q->notfull);
+  return 0;
+}
@@ -257,7 +257,7 @@ static int lock(pthread_mutex_t *mutex, SceUInt *t)
        * that it would have obtained by each of these protocols.
        */
       int p = sceKernelGetThreadCurrentPriority();
-      me->priomutex[mutex->prioceiling]++;
+      me->cold.priomutex[mutex->prioceiling]++;
       
       if (mutex->prioceiling < p) 
         {
@@ -445,11 +445,11 @@ EXTERN int pthread_mutex_unlock(pthread_mutex_t *mutex)
 
 	  if (mutex->protocol == PTHREAD_PRIO_PROTECT)
 		{
-		  me->priomutex[mutex->prioceiling]--;
+		  me->cold.priomutex[mutex->prioceiling]--;
 		  // Set the thread priority to the highest priority of the 
 		  // mutex owned, or the orignial priority of the thread
 		  for (i = 0; i < 128; i++)
-			if (i == me->priority || me->priomutex[i] > 0)
+			if (i == me->priority || me->cold.priomutex[i] > 0)
 			  {
 				// ### We should prevent dispatching because we are lowering 
 				// our priority and we could be put in a situation where we will
@@ -477,6 +477,96 @@ EXTERN int pthread_mutex_unlock(pthread_mutex_t *mutex)
 }
 
 
+/*
+ * pthread_mutex_lock_many_np acquires the n mutexes of the array without
+ * deadlocking against other threads locking an overlapping set in a
+ * different order.  Rather than imposing a global order, it blocks on
+ * one mutex and only tries the others.  When one of them is busy,
+ * everything is released and the next attempt blocks on the mutex that
+ * was busy: the caller sleeps in the kernel until the contended mutex
+ * is handed over instead of spinning on the try, and it is likely to
+ * find the other ones free once it has it.
+ */
+
+EXTERN int pthread_mutex_lock_many_np(pthread_mutex_t * const *mutexes, int n)
+{
+  pthread_t me;
+  int first = 0;
+  int i, j, k, res;
+
+  if (!g_pThreadLocking)
+    return 0;
+
+  if (mutexes == NULL || n < 0)
+    return EINVAL;
+
+  // A non recursive mutex listed twice, or already ours, could never
+  // be acquired
+  me = pthread_self();
+  for (i = 0; i < n; i++)
+    {
+      if (!VALID(mutexes[i])) return EINVAL;
+      if (mutexes[i]->type == PTHREAD_MUTEX_RECURSIVE)
+        continue;
+      if (mutexes[i]->owner == me)
+        return EDEADLK;
+      for (j = i + 1; j < n; j++)
+        if (mutexes[i] == mutexes[j])
+          return EDEADLK;
+    }
+
+  if (n == 0)
+    return 0;
+
+  for (;;)
+    {
+      res = lock(mutexes[first], NULL);
+      if (res != 0)
+        return res;
+
+      // Try the others, starting after the one we block on
+      for (k = 1; k < n; k++)
+        {
+          i = (first + k) % n;
+          res = pthread_mutex_trylock(mutexes[i]);
+          if (res != 0)
+            break;
+        }
+      if (k == n)
+        return 0;
+
+      // Back off: release what we hold, in reverse order
+      while (--k >= 0)
+        pthread_mutex_unlock(mutexes[(first + k) % n]);
+      if (res != EBUSY)
+        return res;
+
+      first = i;
+      sched_yield();
+    }
+}
+
+
+EXTERN int pthread_mutex_unlock_many_np(pthread_mutex_t * const *mutexes, int n)
+{
+  int i, res, ret = 0;
+
+  if (!g_pThreadLocking)
+    return 0;
+
+  if (mutexes == NULL || n < 0)
+    return EINVAL;
+
+  for (i = n - 1; i >= 0; i--)
+    {
+      res = pthread_mutex_unlock(mutexes[i]);
+      if (res != 0)
+        ret = res;
+    }
+  return ret;
+}
+
+
 /*
  * The pthread_mutex_getprioceiling subroutine returns the current priority 
  * ceiling of the mutex.
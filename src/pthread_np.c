@@ -79,3 +79,66 @@ EXTERN int pthread_getthreadid_np(pthread_t thread, int *id)
   *id = thread->id;
   return 0;
 }
+
+
+/*
+ * The target thread is temporarily raised to the priority of the
+ * caller, if it is lower, and the caller goes behind it in the ready
+ * queue.  The target priority is restored when the caller runs again,
+ * unless it has been changed in the meantime.
+ *
+ * A target whose priority was raised by a mutex (priority inheritance
+ * or ceiling) keeps it untouched.  A target running, or only allowed
+ * to run, on another core gains nothing from the caller's core, which
+ * then simply yields.
+ */
+
+EXTERN int pthread_yield_to_np(pthread_t thread)
+{
+  SceKernelThreadInfo info, myinfo;
+  int myprio, oldprio, boost;
+  int res;
+
+  if (thread == NULL)
+    return EINVAL;
+  if (thread == pthread_self())
+    return sched_yield() ? errno : 0;
+  if (thread->terminated)
+    return ESRCH;
+
+  info.size = sizeof(info);
+  res = sceKernelGetThreadInfo(thread->id, &info);
+  if (res < 0)
+    return ESRCH;
+
+  myinfo.size = sizeof(myinfo);
+  res = sceKernelGetThreadInfo(sceKernelGetThreadId(), &myinfo);
+  sceCHECK(res);
+  if (res < 0 || info.status == SCE_KERNEL_THREAD_STATUS_RUNNING ||
+      (info.currentCpuAffinityMask & (SCE_KERNEL_CPU_MASK_USER_0 << myinfo.currentCpuId)) == 0)
+    return sched_yield() ? errno : 0;
+
+  myprio = myinfo.currentPriority;
+  oldprio = info.currentPriority;
+  // A priority raised by a mutex is left to the mutex
+  boost = oldprio > myprio && oldprio == thread->priority;
+  if (boost)
+    {
+      res = sceKernelChangeThreadPriority(thread->id, myprio);
+      sceCHECK(res);
+    }
+
+  res = sceKernelRotateThreadReadyQueue(myprio);
+  sceCHECK(res);
+
+  if (boost)
+    {
+      res = sceKernelGetThreadInfo(thread->id, &info);
+      if (res == SCE_OK && info.currentPriority == myprio)
+        {
+          res = sceKernelChangeThreadPriority(thread->id, oldprio);
+          sceCHECK(res);
+        }
+    }
+  return 0;
+}
@@ -0,0 +1,329 @@
+//Sony Computer Entertainment Confidential
+#include "pthread/include/pthread.h"
+
+/* Common definitions */
+#define VALID(pool) \
+	(((pool) != 0) && ((pool)->size != 0))
+#define INVALIDATE(pool) \
+	do { (pool)->size = 0; } while(0)
+
+#define ALIGN           8
+#define DEFAULT_SLAB    64
+#define HEADER          ((sizeof(pthread_lifo_node_t) + ALIGN - 1) & ~(ALIGN - 1))
+
+/*
+ * Object pool with magazines after Bonwick, as the bundled allocator:
+ * every thread caches two magazines of free objects, in a cache found
+ * in the list of its pthread_storage_t, and only exchanges whole
+ * magazines with the depot,
+ * made of lock free LIFOs.  Allocating and freeing thus only touch the
+ * thread's own magazines in the common case, and an object freed by
+ * another thread than the one which allocated it simply goes into the
+ * magazines of the freeing thread, to flow back through the depot.
+ *
+ * The objects are carved from slabs, which are only freed with the
+ * pool, so that a pop of a LIFO can always read the link of a stale
+ * top.
+ *
+ * The caches are reused by the threads created later, and freed with
+ * the pool.  An exiting thread gives its magazines back to the depot.
+ * A pool destroyed while a cache is still in the list of another
+ * thread leaves the cache to that thread, which frees it on its next
+ * search of the list or when it exits.
+ */
+
+static void *carve(pthread_pool_t *pool)
+{
+  char *slab;
+  unsigned int i;
+  void *obj;
+
+  obj = pthread_lifo_pop_np(&pool->objects);
+  if (obj != NULL)
+    return obj;
+
+  slab = (char *)PTHREAD_MALLOC(HEADER + pool->slab * pool->size);
+  if (slab == NULL)
+    return NULL;
+  pthread_lifo_push_np(&pool->slabs, (pthread_lifo_node_t *)slab);
+  for (i = 1; i < pool->slab; i++)
+    pthread_lifo_push_np(&pool->objects, (pthread_lifo_node_t *)(slab + HEADER + i * pool->size));
+  return slab + HEADER;
+}
+
+
+static void drain(pthread_pool_t *pool, pthread_pool_cache_t *c)
+{
+  pthread_magazine_t *m;
+  int i;
+
+  for (i = 0; i < 2; i++)
+    {
+      m = c->mags[i];
+      c->mags[i] = NULL;
+      if (m == NULL)
+        continue;
+      if (m->count > 0)
+        pthread_lifo_push_np(&pool->full, &m->node);
+      else
+        pthread_lifo_push_np(&pool->empty, &m->node);
+    }
+}
+
+
+static pthread_pool_cache_t *attach(pthread_pool_t *pool)
+{
+  pthread_pool_cache_t *c, *old;
+
+  for (c = (pthread_pool_cache_t *)ATOMIC_LOAD_PTR(&pool->caches, ATOMIC_ACQUIRE); c != NULL; c = c->next)
+    if (c->active == 0 && ATOMIC_CAS_EXPLICIT(&c->active, 0, 1, ATOMIC_ACQUIRE) == 0)
+      return c;
+
+  c = (pthread_pool_cache_t *)PTHREAD_MALLOC(sizeof(pthread_pool_cache_t));
+  if (c == NULL)
+    return NULL;
+  c->active = 1;
+  c->pool = pool;
+  c->mags[0] = c->mags[1] = NULL;
+  do {
+    old = pool->caches;
+    c->next = old;
+  } while (ATOMIC_CAS_PTR(&pool->caches, old, c, ATOMIC_RELEASE) != old);
+  return c;
+}
+
+
+/*
+ * Cache of the calling thread for pool, moved to the front of its list,
+ * or NULL for the threads unknown to the library.
+ */
+
+static inline pthread_pool_cache_t *cache(pthread_pool_t *pool)
+{
+  pthread_t me = pthread_current_();
+  pthread_pool_cache_t *c, **prev;
+
+  if (me == NULL)
+    return NULL;
+
+  c = me->pool_caches;
+  if (c != NULL && ATOMIC_LOAD_PTR(&c->pool, ATOMIC_RELAXED) == pool)
+    return c;
+
+  for (prev = &me->pool_caches; (c = *prev) != NULL; )
+    {
+      if (ATOMIC_LOAD_PTR(&c->pool, ATOMIC_ACQUIRE) == NULL)
+        {
+          // Left by a destroyed pool
+          *prev = c->link;
+          PTHREAD_FREE(c);
+          continue;
+        }
+      if (c->pool == pool)
+        {
+          *prev = c->link;
+          break;
+        }
+      prev = &c->link;
+    }
+
+  if (c == NULL && (c = attach(pool)) == NULL)
+    return NULL;
+  c->link = me->pool_caches;
+  me->pool_caches = c;
+  return c;
+}
+
+
+/*
+ * Objects of size bytes, rounded up to a multiple of 8, allocated by
+ * slabs of slab objects, or a default number if 0.
+ */
+
+EXTERN int pthread_pool_init_np(pthread_pool_t *pool, size_t size, unsigned int slab)
+{
+  CHECK_PT_PTR(pool);
+  if (size == 0)
+    return EINVAL;
+
+  pool->size = (size + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+  pool->slab = slab != 0 ? slab : DEFAULT_SLAB;
+  pool->caches = NULL;
+  pthread_lifo_init_np(&pool->full);
+  pthread_lifo_init_np(&pool->empty);
+  pthread_lifo_init_np(&pool->objects);
+  pthread_lifo_init_np(&pool->slabs);
+  return 0;
+}
+
+
+/*
+ * Free the pool and all its objects.  No other thread may use the pool
+ * meanwhile.
+ */
+
+EXTERN int pthread_pool_destroy_np(pthread_pool_t *pool)
+{
+  pthread_pool_cache_t *c, *next, *mine, **prev;
+  pthread_lifo_node_t *n, *nn;
+  pthread_t me;
+
+  if (!VALID(pool)) return EINVAL;
+
+  mine = NULL;
+  me = pthread_current_();
+  if (me != NULL)
+    for (prev = &me->pool_caches; (c = *prev) != NULL; prev = &c->link)
+      if (c->pool == pool)
+        {
+          *prev = c->link;
+          mine = c;
+          break;
+        }
+
+  for (c = pool->caches; c != NULL; c = next)
+    {
+      next = c->next;
+      PTHREAD_FREE(c->mags[0]);
+      PTHREAD_FREE(c->mags[1]);
+      if (c->active && c != mine)
+        ATOMIC_STORE_PTR(&c->pool, NULL, ATOMIC_RELEASE);       // Still in the list of another thread, freed by it
+      else
+        PTHREAD_FREE(c);
+    }
+
+  for (n = pthread_lifo_pop_all_np(&pool->full); n != NULL; n = nn)
+    {
+      nn = n->next;
+      PTHREAD_FREE(n);
+    }
+  for (n = pthread_lifo_pop_all_np(&pool->empty); n != NULL; n = nn)
+    {
+      nn = n->next;
+      PTHREAD_FREE(n);
+    }
+  for (n = pthread_lifo_pop_all_np(&pool->slabs); n != NULL; n = nn)
+    {
+      nn = n->next;
+      PTHREAD_FREE(n);
+    }
+
+  INVALIDATE(pool);
+  return 0;
+}
+
+
+EXTERN void *pthread_pool_alloc_np(pthread_pool_t *pool)
+{
+  pthread_pool_cache_t *c;
+  pthread_magazine_t **mag, *m;
+
+  if (!VALID(pool)) return NULL;
+
+  c = cache(pool);
+  if (c == NULL)
+    return carve(pool);
+  mag = c->mags;
+
+  if (mag[0] != NULL && mag[0]->count > 0)
+    return mag[0]->rounds[--mag[0]->count];
+
+  if (mag[1] != NULL && mag[1]->count > 0)
+    {
+      m = mag[0];
+      mag[0] = mag[1];
+      mag[1] = m;
+      return mag[0]->rounds[--mag[0]->count];
+    }
+
+  // Both are empty, exchange one for a full magazine of the depot
+  m = (pthread_magazine_t *)pthread_lifo_pop_np(&pool->full);
+  if (m == NULL)
+    return carve(pool);
+  if (mag[1] != NULL)
+    pthread_lifo_push_np(&pool->empty, &mag[1]->node);
+  mag[1] = mag[0];
+  mag[0] = m;
+  return m->rounds[--m->count];
+}
+
+
+/*
+ * Give obj back to the pool, from any thread.
+ */
+
+EXTERN int pthread_pool_free_np(pthread_pool_t *pool, void *obj)
+{
+  pthread_pool_cache_t *c;
+  pthread_magazine_t **mag, *m;
+
+  if (!VALID(pool) || obj == NULL) return EINVAL;
+
+  c = cache(pool);
+  if (c == NULL)
+    {
+      pthread_lifo_push_np(&pool->objects, (pthread_lifo_node_t *)obj);
+      return 0;
+    }
+  mag = c->mags;
+
+  if (mag[0] != NULL && mag[0]->count < PTHREAD_MAGAZINE_SIZE_)
+    {
+      mag[0]->rounds[mag[0]->count++] = obj;
+      return 0;
+    }
+
+  if (mag[1] != NULL && mag[1]->count < PTHREAD_MAGAZINE_SIZE_)
+    {
+      m = mag[0];
+      mag[0] = mag[1];
+      mag[1] = m;
+      mag[0]->rounds[mag[0]->count++] = obj;
+      return 0;
+    }
+
+  // Both are full (or missing), exchange one for an empty magazine
+  m = (pthread_magazine_t *)pthread_lifo_pop_np(&pool->empty);
+  if (m == NULL)
+    {
+      m = (pthread_magazine_t *)PTHREAD_MALLOC(sizeof(pthread_magazine_t));
+      if (m == NULL)
+        {
+          pthread_lifo_push_np(&pool->objects, (pthread_lifo_node_t *)obj);
+          return 0;
+        }
+      m->count = 0;
+    }
+  if (mag[1] != NULL)
+    pthread_lifo_push_np(&pool->full, &mag[1]->node);
+  mag[1] = mag[0];
+  mag[0] = m;
+  m->rounds[m->count++] = obj;
+  return 0;
+}
+
+
+/*
+ * Give the caches of an exiting thread back to their pools, and free
+ * the ones left by the destroyed pools.
+ */
+
+EXTERN void pthread_pool_release_(pthread_t th)
+{
+  pthread_pool_cache_t *c, *next;
+  pthread_pool_t *pool;
+
+  for (c = th->pool_caches; c != NULL; c = next)
+    {
+      next = c->link;
+      pool = (pthread_pool_t *)ATOMIC_LOAD_PTR(&c->pool, ATOMIC_ACQUIRE);
+      if (pool == NULL)
+        PTHREAD_FREE(c);
+      else
+        {
+          drain(pool, c);
+          ATOMIC_STORE(&c->active, 0, ATOMIC_RELEASE);
+        }
+    }
+  th->pool_caches = NULL;
+}
@@ -0,0 +1,193 @@
+//Sony Computer Entertainment Confidential
+#include "pthread/include/pthread.h"
+
+/*
+ * Read-Copy-Update
+ *
+ * Every thread publishes in its pthread_storage_t the grace period
+ * counter it observed when it entered its outermost read-side critical
+ * section, or 0 when it is quiescent.  A grace period is started by
+ * bumping the global counter, and is complete once no registered thread
+ * is still inside a critical section entered under an older counter.
+ */
+
+static volatile unsigned long rcu_gp_ctr = 1;
+static pthread_mutex_t rcu_gp_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Deferred callbacks, run by the rcu worker thread */
+static pthread_rcu_head_t * volatile rcu_callbacks = NULL;
+static SceUID rcu_sema = INVALID_ID_;
+
+static pthread_once_t worker_once_control = PTHREAD_ONCE_INIT;
+
+
+EXTERN void pthread_rcu_read_lock_np(void)
+{
+  pthread_t me = pthread_self();
+
+  if (me->rcu_nesting++ == 0)
+    {
+      me->rcu_ctr = rcu_gp_ctr;
+      // The snapshot must be visible before any protected data is read
+      ATOMIC_FENCE(ATOMIC_SEQ_CST);
+    }
+}
+
+
+EXTERN void pthread_rcu_read_unlock_np(void)
+{
+  pthread_t me = pthread_self();
+
+  if (--me->rcu_nesting == 0)
+    ATOMIC_STORE((volatile long *)&me->rcu_ctr, 0, ATOMIC_RELEASE);
+}
+
+
+/*
+ * Returns non zero if a registered thread is still inside a read-side
+ * critical section that started before the grace period ctr.
+ */
+
+static int readers_pending(unsigned long ctr)
+{
+  pthread_t th;
+  unsigned long c;
+  int pending = 0;
+
+  ENTER_CRITICAL();
+  for (th = pthread_list_; th != NULL; th = th->next)
+    {
+      c = th->rcu_ctr;
+      if (c != 0 && c != ctr)
+        {
+          pending = 1;
+          break;
+        }
+    }
+  LEAVE_CRITICAL();
+  return pending;
+}
+
+
+EXTERN void pthread_synchronize_rcu_np(void)
+{
+  unsigned long ctr;
+
+  pthread_mutex_lock(&rcu_gp_mutex);
+
+  // Make the updates done by the caller visible before the new grace period
+  ctr = rcu_gp_ctr + 1;
+  if (ctr == 0)
+    ctr = 1;
+  ATOMIC_STORE((volatile long *)&rcu_gp_ctr, ctr, ATOMIC_SEQ_CST);
+
+  // The registry lock is not held while waiting, a reader may need it
+  // (to create a thread for instance) before leaving its critical section
+  while (readers_pending(ctr))
+    sceKernelDelayThread(1);
+
+  ATOMIC_FENCE(ATOMIC_ACQUIRE);
+  pthread_mutex_unlock(&rcu_gp_mutex);
+}
+
+
+static void *worker(void *arg)
+{
+  pthread_rcu_head_t *list, *next, *prev;
+  int res;
+
+  // Unused parameters
+  (void)&arg;
+
+  for (;;)
+    {
+      res = sceKernelWaitSema(rcu_sema, 1, NULL);
+      sceCHECK(res);
+
+      list = (pthread_rcu_head_t *)ATOMIC_SWAP_PTR(&rcu_callbacks, NULL, ATOMIC_ACQUIRE);
+      if (list == NULL)
+        continue;
+
+      pthread_synchronize_rcu_np();
+
+      // The list was built LIFO, run the callbacks in submission order
+      prev = NULL;
+      while (list != NULL)
+        {
+          next = list->next;
+          list->next = prev;
+          prev = list;
+          list = next;
+        }
+      for (list = prev; list != NULL; list = next)
+        {
+          next = list->next;
+          list->func(list);
+        }
+    }
+  return NULL;
+}
+
+
+static void start_worker()
+{
+  pthread_attr_t attr;
+  pthread_t th;
+  int res;
+
+  res = sceKernelCreateSema("pthread rcu", SCE_KERNEL_ATTR_TH_FIFO,
+                            0, 0x7fffffff, NULL);
+  if (res <= 0)
+    {
+      sceCHECK(res);
+      return;
+    }
+  rcu_sema = res;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_attr_setstacksize(&attr, 16*1024);
+  pthread_attr_setname_np(&attr, "rcu");
+  res = pthread_create(&th, &attr, worker, NULL);
+  if (res != 0)
+    {
+      pCHECK(res);
+      sceKernelDeleteSema(rcu_sema);
+      rcu_sema = INVALID_ID_;
+    }
+  pthread_attr_destroy(&attr);
+}
+
+
+/*
+ * Queue func to be called with head once a grace period has elapsed.
+ * The callbacks are batched and run by a background thread.
+ */
+
+EXTERN int pthread_call_rcu_np(pthread_rcu_head_t *head,
+                               void (*func)(pthread_rcu_head_t *))
+{
+  pthread_rcu_head_t *old;
+  int res;
+
+  if (head == NULL || func == NULL)
+    return EINVAL;
+
+  pthread_once(&worker_once_control, start_worker);
+  if (rcu_sema == INVALID_ID_)
+    return EAGAIN;
+
+  head->func = func;
+  do {
+    old = rcu_callbacks;
+    head->next = old;
+  } while (ATOMIC_CAS_PTR(&rcu_callbacks, old, head, ATOMIC_RELEASE) != old);
+
+  // Only the transition to a non empty list needs to wake the worker
+  if (old == NULL)
+    {
+      res = sceKernelSignalSema(rcu_sema, 1);
+      sceCHECK(res);
+    }
+  return 0;
+}
@@ -0,0 +1,211 @@
+//Sony Computer Entertainment Confidential
+#include "pthread/include/pthread.h"
+
+/*
+ * Pool of pre-created kernel semaphores, so that the initialization of
+ * the threads and of the synchronization objects does not create any.
+ * There are two kinds of semaphores, all of a kind being created with
+ * the same parameters: the control semaphores of INIT_CONTROL, and the
+ * wait semaphores of the conds, barriers and wait queues.
+ *
+ * A semaphore given back is reset to its initial count and kept, up to
+ * the high mark, and deleted otherwise.  Once the pool of a kind falls
+ * to the low mark, a background thread refills it up to the high mark.
+ * An empty pool falls back to creating the semaphore in place.
+ *
+ * The pool is off until configured with pthread_set_semapool_np.
+ */
+
+#define OFF             0
+#define STARTING        1
+#define ON              2
+#define MAX_HIGH        4096
+
+typedef struct
+{
+  const char           *name;
+  int                   init;
+  int                   max;
+  pthread_mpmcq_t       queue;
+  volatile long         count;          // Semaphores in the queue, approximately
+} pool_t;
+
+static pool_t pools[PTHREAD_SEMA_KINDS_] = {
+  { "pthread control", 1, 1 },
+  { "pthread wait", 0, 0x7fffffff },
+};
+
+static volatile long state = OFF;
+static long low, high;
+static volatile long refill_pending = 0;
+static SceUID refill_sema = INVALID_ID_;
+
+
+static SceUID create(pool_t *p, const char *name)
+{
+  return sceKernelCreateSema(name != NULL ? name : p->name, SCE_KERNEL_ATTR_TH_FIFO,
+                             p->init, p->max, NULL);
+}
+
+
+static void wake_refill(void)
+{
+  int res;
+
+  if (ATOMIC_CAS_EXPLICIT(&refill_pending, 0, 1, ATOMIC_ACQ_REL) == 0)
+    {
+      res = sceKernelSignalSema(refill_sema, 1);
+      sceCHECK(res);
+    }
+}
+
+
+static void *refill(void *arg)
+{
+  pool_t *p;
+  SceUID id;
+  int res, k;
+
+  (void)&arg;
+
+  for (;;)
+    {
+      res = sceKernelWaitSema(refill_sema, 1, NULL);
+      if (res < 0)
+        {
+          sceCHECK(res);
+          return NULL;
+        }
+      // A kind falling to the low mark meanwhile signals again
+      ATOMIC_STORE(&refill_pending, 0, ATOMIC_RELEASE);
+
+      for (k = 0; k < PTHREAD_SEMA_KINDS_; k++)
+        {
+          p = &pools[k];
+          while (ATOMIC_LOAD(&p->count, ATOMIC_RELAXED) < high)
+            {
+              id = create(p, NULL);
+              if (id <= 0)
+                {
+                  sceCHECK(id);
+                  break;
+                }
+              if (pthread_mpmcq_trypush_np(&p->queue, (void *)id) != 0)
+                {
+                  res = sceKernelDeleteSema(id);
+                  sceCHECK(res);
+                  break;
+                }
+              ATOMIC_FETCH_ADD(&p->count, 1, ATOMIC_RELAXED);
+            }
+        }
+    }
+}
+
+
+/*
+ * Turn the pool on: every kind is kept between lowmark and highmark
+ * semaphores.  Possible only once.
+ */
+
+EXTERN int pthread_set_semapool_np(unsigned int lowmark, unsigned int highmark)
+{
+  pthread_attr_t attr;
+  struct sched_param param;
+  pthread_t th;
+  int res, k;
+
+  if (highmark == 0 || highmark > MAX_HIGH || lowmark >= highmark)
+    return EINVAL;
+  if (ATOMIC_CAS_EXPLICIT(&state, OFF, STARTING, ATOMIC_ACQ_REL) != OFF)
+    return EBUSY;
+
+  for (k = 0; k < PTHREAD_SEMA_KINDS_; k++)
+    {
+      res = pthread_mpmcq_init_np(&pools[k].queue, highmark);
+      if (res != 0)
+        goto fail;
+    }
+
+  res = sceKernelCreateSema("pthread semapool", SCE_KERNEL_ATTR_TH_FIFO, 0, 1, NULL);
+  if (res <= 0)
+    {
+      sceCHECK(res);
+      res = ERROR_errno_sce(res);
+      goto fail;
+    }
+  refill_sema = res;
+  low = lowmark;
+  high = highmark;
+
+  // The refill runs below the default priority of the threads
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_attr_setname_np(&attr, "semapool");
+  param.sched_priority = SCE_KERNEL_PROCESS_PRIORITY_USER_LOW;
+  pthread_attr_setschedparam(&attr, &param);
+  res = pthread_create(&th, &attr, refill, NULL);
+  if (res != 0)
+    {
+      sceKernelDeleteSema(refill_sema);
+      refill_sema = INVALID_ID_;
+      goto fail;
+    }
+
+  ATOMIC_STORE(&state, ON, ATOMIC_RELEASE);
+  wake_refill();
+  return 0;
+
+ fail:
+  while (--k >= 0)
+    pthread_mpmcq_destroy_np(&pools[k].queue);
+  ATOMIC_STORE(&state, OFF, ATOMIC_RELEASE);
+  return res;
+}
+
+
+/*
+ * Returns a semaphore of the given kind, or a negative sce error.  The
+ * semaphores created in place are given name, if not NULL.
+ */
+
+EXTERN SceUID pthread_sema_get_(int kind, const char *name)
+{
+  pool_t *p = &pools[kind];
+  void *id;
+
+  if (ATOMIC_LOAD(&state, ATOMIC_ACQUIRE) != ON)
+    return create(p, name);
+
+  if (pthread_mpmcq_trypop_np(&p->queue, &id) == 0)
+    {
+      if (ATOMIC_FETCH_ADD(&p->count, -1, ATOMIC_RELAXED) - 1 <= low)
+        wake_refill();
+      return (SceUID)id;
+    }
+
+  wake_refill();
+  return create(p, name);
+}
+
+
+EXTERN void pthread_sema_put_(int kind, SceUID id)
+{
+  pool_t *p = &pools[kind];
+  unsigned int n;
+  int res;
+
+  if (ATOMIC_LOAD(&state, ATOMIC_ACQUIRE) == ON && ATOMIC_LOAD(&p->count, ATOMIC_RELAXED) < high)
+    {
+      // Back to its initial count for the next user
+      res = sceKernelCancelSema(id, -1, &n);
+      if (res == SCE_OK && pthread_mpmcq_trypush_np(&p->queue, (void *)id) == 0)
+        {
+          ATOMIC_FETCH_ADD(&p->count, 1, ATOMIC_RELAXED);
+          return;
+        }
+    }
+
+  res = sceKernelDeleteSema(id);
+  sceCHECK(res);
+}
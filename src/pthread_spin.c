@@ -7,6 +7,10 @@
 #define INVALIDATE(lock) \
 	(lock->lock = 2)
 
+// Bounds of the exponential backoff after a lost race, in relax hints
+#define BACKOFF_MIN   4
+#define BACKOFF_MAX   1024
+
 
 /*
  * The pthread_spin_destroy subroutine destroys the spin 
@@ -29,10 +33,26 @@ EXTERN int pthread_spin_destroy(pthread_spinlock_t *lock)
 
 EXTERN int pthread_spin_init(pthread_spinlock_t *lock, int pshared)
 {
-  CHECK_PT_PTR(lock);
   // Unused parameters
   (void)&pshared;
+  return pthread_spin_init_np(lock, PTHREAD_SPINLOCK_TAS_NP);
+}
+
+
+EXTERN int pthread_spin_init_np(pthread_spinlock_t *lock, int type)
+{
+  CHECK_PT_PTR(lock);
+  if (type != PTHREAD_SPINLOCK_TAS_NP && 
+      type != PTHREAD_SPINLOCK_TICKET_NP &&
+      type != PTHREAD_SPINLOCK_MCS_NP)
+    return EINVAL;
+
   lock->lock = 0;
+  lock->type = type;
+  lock->next = 0;
+  lock->serving = 0;
+  lock->tail = NULL;
+  lock->holder = NULL;
   return 0;
 }
 
@@ -53,22 +73,189 @@ EXTERN int pthread_spin_init(pthread_spinlock_t *lock, int pshared)
  * called with an uninitialized spin lock.
  */
 
+/*
+ * Test and test and set: the waiters only read the lock, which keeps
+ * their copy of the cache line shared, and sleep in wfe until the
+ * owner signals the release with sev.  Only when the lock is seen free
+ * do they try the exclusive ldrex/strex, backing off exponentially
+ * after losing the race to another core.
+ */
+
+static void tas_lock(pthread_spinlock_t *lock)
+{
+  int backoff = BACKOFF_MIN;
+  int i;
+
+  for (;;)
+    {
+      while (lock->lock != 0)
+        CPU_WAIT_EVENT();
+
+      if (ATOMIC_CAS_EXPLICIT((volatile long *)&lock->lock, 0, 1, ATOMIC_ACQUIRE) == 0)
+        break;
+
+      for (i = 0; i < backoff; i++)
+        CPU_RELAX();
+      if (backoff < BACKOFF_MAX)
+        backoff <<= 1;
+    }
+}
+
+
+/*
+ * Ticket lock: a single atomic increment hands out the ticket, then
+ * the waiter reads serving until its turn comes.
+ */
+
+static void ticket_lock(pthread_spinlock_t *lock)
+{
+  unsigned long ticket;
+
+  ticket = ATOMIC_FETCH_ADD((volatile long *)&lock->next, 1, ATOMIC_RELAXED);
+  while (lock->serving != ticket)
+    CPU_WAIT_EVENT();
+  ATOMIC_FENCE(ATOMIC_ACQUIRE);
+}
+
+
+/*
+ * MCS lock: the waiters queue their own node behind the tail of the
+ * lock and spin on it until their predecessor hands the lock over, so
+ * a release only touches the cache line of the next waiter.  The nodes
+ * come from the thread storage since the spin lock interface has no
+ * room for them.
+ */
+
+static pthread_mcs_node_t *mcs_node(pthread_t me)
+{
+  pthread_mcs_node_t *nodes;
+  int i;
+
+  for (i = 0; i < PTHREAD_MCS_NODES_; i++)
+    if ((me->mcs_used & (1UL << i)) == 0)
+      break;
+  if (i == PTHREAD_MCS_NODES_)
+    return NULL;
+
+  nodes = (pthread_mcs_node_t *)
+    (((unsigned long)me->mcs_mem + PTHREAD_CACHELINE_SIZE_ - 1) & ~(PTHREAD_CACHELINE_SIZE_ - 1));
+  me->mcs_used |= 1UL << i;
+  nodes[i].index = i;
+  nodes[i].next = NULL;
+  nodes[i].locked = 1;
+  return &nodes[i];
+}
+
+
+static int mcs_lock(pthread_spinlock_t *lock)
+{
+  pthread_mcs_node_t *node, *pred;
+
+  node = mcs_node(pthread_self());
+  if (node == NULL)
+    return EAGAIN;
+
+  pred = (pthread_mcs_node_t *)ATOMIC_SWAP_PTR(&lock->tail, node, ATOMIC_ACQ_REL);
+  if (pred != NULL)
+    {
+      ATOMIC_STORE_PTR(&pred->next, node, ATOMIC_RELEASE);
+      while (node->locked)
+        CPU_WAIT_EVENT();
+      ATOMIC_FENCE(ATOMIC_ACQUIRE);
+    }
+  lock->holder = node;
+  return 0;
+}
+
+
+static int mcs_trylock(pthread_spinlock_t *lock)
+{
+  pthread_t me = pthread_self();
+  pthread_mcs_node_t *node;
+
+  if (lock->tail != NULL)
+    return EBUSY;
+
+  node = mcs_node(me);
+  if (node == NULL)
+    return EAGAIN;
+
+  if (ATOMIC_CAS_PTR(&lock->tail, NULL, node, ATOMIC_ACQ_REL) != NULL)
+    {
+      me->mcs_used &= ~(1UL << node->index);
+      return EBUSY;
+    }
+  lock->holder = node;
+  return 0;
+}
+
+
+static int mcs_unlock(pthread_spinlock_t *lock)
+{
+  pthread_mcs_node_t *node = lock->holder, *succ;
+
+  if (node == NULL)
+    return EPERM;
+  lock->holder = NULL;
+
+  succ = node->next;
+  if (succ == NULL)
+    {
+      if (ATOMIC_CAS_PTR(&lock->tail, node, NULL, ATOMIC_RELEASE) == node)
+        goto done;
+      // A waiter is linking itself behind us
+      while ((succ = node->next) == NULL)
+        CPU_RELAX();
+    }
+  ATOMIC_STORE(&succ->locked, 0, ATOMIC_RELEASE);
+  SYNC_BARRIER();
+  CPU_SEND_EVENT();
+
+ done:
+  pthread_self()->mcs_used &= ~(1UL << node->index);
+  return 0;
+}
+
+
 EXTERN int pthread_spin_lock(pthread_spinlock_t *lock)
 {
+  int res = 0;
+
   if (!VALID(lock)) return EINVAL;
-  while (test_and_set_bit(0, &lock->lock) != 0)
-    ;
-  return 0;
+
+  if (lock->type == PTHREAD_SPINLOCK_MCS_NP)
+    res = mcs_lock(lock);
+  else if (lock->type == PTHREAD_SPINLOCK_TICKET_NP)
+    ticket_lock(lock);
+  else
+    tas_lock(lock);
+  return res;
 }
 
 
 EXTERN int pthread_spin_trylock(pthread_spinlock_t *lock)
 {
+  unsigned long ticket;
+  int res;
+
   if (!VALID(lock)) return EINVAL;
-  if (test_and_set_bit(0, &lock->lock) == 0)
-    return 0;
+
+  if (lock->type == PTHREAD_SPINLOCK_MCS_NP)
+    res = mcs_trylock(lock);
+  else if (lock->type == PTHREAD_SPINLOCK_TICKET_NP)
+    {
+      ticket = lock->serving;
+      if (lock->next == ticket && 
+          ATOMIC_CAS_EXPLICIT((volatile long *)&lock->next, ticket, ticket + 1, ATOMIC_ACQUIRE) == (long)ticket)
+        res = 0;
+      else
+        res = EBUSY;
+    }
+  else if (lock->lock == 0 && ATOMIC_CAS_EXPLICIT((volatile long *)&lock->lock, 0, 1, ATOMIC_ACQUIRE) == 0)
+    res = 0;
   else
-    return EBUSY;
+    res = EBUSY;
+  return res;
 }
 
 
@@ -89,8 +276,25 @@ EXTERN int pthread_spin_trylock(pthread_spinlock_t *lock)
 EXTERN int pthread_spin_unlock(pthread_spinlock_t *lock)
 {
   if (!VALID(lock)) return EINVAL;
-  if (test_and_clear_bit(0, &lock->lock))
-    return 0;
+
+  if (lock->type == PTHREAD_SPINLOCK_MCS_NP)
+    return mcs_unlock(lock);
+
+  if (lock->type == PTHREAD_SPINLOCK_TICKET_NP)
+    {
+      if (lock->next == lock->serving)
+        return EPERM;
+      ATOMIC_STORE((volatile long *)&lock->serving, lock->serving + 1, ATOMIC_RELEASE);
+    }
   else
-    return EPERM;
+    {
+      if (lock->lock == 0)
+        return EPERM;
+      ATOMIC_STORE((volatile long *)&lock->lock, 0, ATOMIC_RELEASE);
+    }
+
+  // The store must be visible before the waiters wake up
+  SYNC_BARRIER();
+  CPU_SEND_EVENT();
+  return 0;
 }
@@ -0,0 +1,222 @@
+//Sony Computer Entertainment Confidential
+#include "pthread/include/pthread.h"
+
+/* Common definitions */
+#define VALID(ring) \
+	(((ring) != 0) && ((ring)->buffer != NULL))
+#define INVALIDATE(ring) \
+	do { (ring)->buffer = NULL; } while(0)
+
+/*
+ * Bipartite buffer: the data is [read, write) while write >= read.
+ * When the end of the buffer is too short for a reservation, the
+ * producer records in watermark where the data stops and goes on at
+ * the start of the buffer; the data is then [read, watermark) followed
+ * by [0, write), until the consumer reaches the watermark and wraps
+ * in turn.  Each index is written by one side only.
+ */
+
+EXTERN int pthread_spscring_destroy_np(pthread_spscring_t *ring)
+{
+  if (!VALID(ring)) return EINVAL;
+
+  pthread_waitq_destroy_(&ring->notfull);
+  pthread_waitq_destroy_(&ring->notempty);
+  PTHREAD_FREE(ring->buffer);
+  INVALIDATE(ring);
+  return 0;
+}
+
+
+EXTERN int pthread_spscring_init_np(pthread_spscring_t *ring, unsigned int size)
+{
+  int res;
+
+  CHECK_PT_PTR(ring);
+  if (size < 2)
+    return EINVAL;
+
+  ring->buffer = (char *)PTHREAD_MALLOC(size);
+  if (ring->buffer == NULL)
+    return ENOMEM;
+  ring->size = size;
+  ring->write = 0;
+  ring->watermark = 0;
+  ring->reserved = 0;
+  ring->reservedlen = 0;
+  ring->read = 0;
+  ring->peekedlen = 0;
+
+  res = pthread_waitq_init_(&ring->notempty, "pthread spscring (e)");
+  if (res == 0)
+    {
+      res = pthread_waitq_init_(&ring->notfull, "pthread spscring (f)");
+      if (res != 0)
+        pthread_waitq_destroy_(&ring->notempty);
+    }
+  if (res != 0)
+    {
+      PTHREAD_FREE(ring->buffer);
+      INVALIDATE(ring);
+    }
+  return res;
+}
+
+
+static int reserve(pthread_spscring_t *ring, unsigned int len, void **ptr)
+{
+  unsigned long w, r, start;
+
+  w = ring->write;
+  r = ATOMIC_LOAD((volatile long *)&ring->read, ATOMIC_ACQUIRE);
+  if (w >= r)
+    {
+      if (ring->size - w >= len)
+        start = w;
+      else if (len < r)
+        start = 0;              // Wrap, keeping start != read
+      else
+        return EAGAIN;
+    }
+  else if (w + len < r)
+    start = w;
+  else
+    return EAGAIN;
+
+  ring->reserved = start;
+  ring->reservedlen = len;
+  *ptr = ring->buffer + start;
+  return 0;
+}
+
+
+static int peek(pthread_spscring_t *ring, void **ptr, unsigned int *len)
+{
+  unsigned long w, r, n;
+
+  r = ring->read;
+  w = ATOMIC_LOAD((volatile long *)&ring->write, ATOMIC_ACQUIRE);
+  if (w >= r)
+    n = w - r;
+  else if (r == ring->watermark)
+    {
+      // Everything before the wrap has been consumed
+      r = 0;
+      ATOMIC_STORE((volatile long *)&ring->read, 0, ATOMIC_RELEASE);
+      n = w;
+    }
+  else
+    n = ring->watermark - r;
+
+  if (n == 0)
+    return EAGAIN;
+  ring->peekedlen = n;
+  *ptr = ring->buffer + r;
+  *len = n;
+  return 0;
+}
+
+
+EXTERN int pthread_spscring_tryreserve_np(pthread_spscring_t *ring, unsigned int len, void **ptr)
+{
+  if (!VALID(ring) || ptr == NULL || len == 0) return EINVAL;
+
+  return reserve(ring, len, ptr);
+}
+
+
+/*
+ * The blocking versions register as waiters before trying again, so
+ * the peer only makes a kernel call when it has actually parked: on
+ * an empty ring for the consumer, on a full one for the producer.
+ */
+
+EXTERN int pthread_spscring_reserve_np(pthread_spscring_t *ring, unsigned int len, void **ptr)
+{
+  int res;
+
+  if (!VALID(ring) || ptr == NULL || len == 0 || len > ring->size / 2) return EINVAL;
+
+  while (reserve(ring, len, ptr) != 0)
+    {
+      pthread_waitq_prepare_(&ring->notfull);
+      if (reserve(ring, len, ptr) == 0)
+        {
+          pthread_waitq_cancel_(&ring->notfull);
+          break;
+        }
+      res = pthread_waitq_wait_(&ring->notfull, NULL);
+      if (res != 0)
+        return res;
+    }
+  return 0;
+}
+
+
+EXTERN int pthread_spscring_commit_np(pthread_spscring_t *ring, unsigned int len)
+{
+  unsigned long w;
+
+  if (!VALID(ring) || len > ring->reservedlen) return EINVAL;
+
+  ring->reservedlen = 0;
+  if (len == 0)
+    return 0;
+
+  w = ring->write;
+  if (ring->reserved != w)
+    {
+      // Wrapped: the data before the wrap stops at the old write
+      ring->watermark = w;
+      ATOMIC_STORE((volatile long *)&ring->write, len, ATOMIC_RELEASE);
+    }
+  else
+    ATOMIC_STORE((volatile long *)&ring->write, w + len, ATOMIC_RELEASE);
+
+  pthread_waitq_wake_(&ring->notempty);
+  return 0;
+}
+
+
+EXTERN int pthread_spscring_trypeek_np(pthread_spscring_t *ring, void **ptr, unsigned int *len)
+{
+  if (!VALID(ring) || ptr == NULL || len == NULL) return EINVAL;
+
+  return peek(ring, ptr, len);
+}
+
+
+EXTERN int pthread_spscring_peek_np(pthread_spscring_t *ring, void **ptr, unsigned int *len)
+{
+  int res;
+
+  if (!VALID(ring) || ptr == NULL || len == NULL) return EINVAL;
+
+  while (peek(ring, ptr, len) != 0)
+    {
+      pthread_waitq_prepare_(&ring->notempty);
+      if (peek(ring, ptr, len) == 0)
+        {
+          pthread_waitq_cancel_(&ring->notempty);
+          break;
+        }
+      res = pthread_waitq_wait_(&ring->notempty, NULL);
+      if (res != 0)
+        return res;
+    }
+  return 0;
+}
+
+
+EXTERN int pthread_spscring_release_np(pthread_spscring_t *ring, unsigned int len)
+{
+  if (!VALID(ring) || len > ring->peekedlen) return EINVAL;
+
+  ring->peekedlen -= len;
+  if (len == 0)
+    return 0;
+  ATOMIC_STORE((volatile long *)&ring->read, ring->read + len, ATOMIC_RELEASE);
+
+  pthread_waitq_wake_(&ring->notfull);
+  return 0;
+}
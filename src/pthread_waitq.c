@@ -0,0 +1,103 @@
+//Sony Computer Entertainment Confidential
+#include "pthread/include/pthread.h"
+
+/*
+ * Wait queues let the lock free primitives park their threads in the
+ * kernel only when they have to, and keep the other side free of
+ * kernel calls when nobody waits.
+ *
+ * A thread that found the condition unmet registers with
+ * pthread_waitq_prepare_, checks the condition again, and then either
+ * waits with pthread_waitq_wait_ or withdraws with pthread_waitq_cancel_.
+ * A thread that made the condition true calls pthread_waitq_wake_,
+ * which is a plain read when there is no waiter.  Every registration
+ * is consumed exactly once, either by a wake up, which turns it into a
+ * semaphore count, or by the cancel, so the semaphore count and the
+ * waiters always add up to the threads still to be woken up.
+ */
+
+EXTERN int pthread_waitq_init_(pthread_waitq_t *q, const char *name)
+{
+  int res;
+
+  q->waiters = 0;
+  res = pthread_sema_get_(PTHREAD_SEMA_WAIT_, name);
+  if (res <= 0)
+    {
+      sceCHECK(res);
+      q->sema = INVALID_ID_;
+      return ERROR_errno_sce(res);
+    }
+  q->sema = res;
+  return 0;
+}
+
+
+EXTERN void pthread_waitq_destroy_(pthread_waitq_t *q)
+{
+  pthread_sema_put_(PTHREAD_SEMA_WAIT_, q->sema);
+  q->sema = INVALID_ID_;
+}
+
+
+EXTERN void pthread_waitq_prepare_(pthread_waitq_t *q)
+{
+  // Ordered before the check of the condition that follows
+  ATOMIC_FETCH_ADD(&q->waiters, 1, ATOMIC_SEQ_CST);
+}
+
+
+EXTERN void pthread_waitq_cancel_(pthread_waitq_t *q)
+{
+  long n;
+  int res;
+
+  do {
+    n = q->waiters;
+    if (n == 0)
+      {
+        // A waker took our registration, take its count
+        res = sceKernelWaitSema(q->sema, 1, NULL);
+        sceCHECK(res);
+        return;
+      }
+  } while (ATOMIC_CAS_EXPLICIT(&q->waiters, n, n - 1, ATOMIC_RELAXED) != n);
+}
+
+
+EXTERN int pthread_waitq_wait_(pthread_waitq_t *q, SceUInt *timeout)
+{
+  int res;
+
+  res = sceKernelWaitSema(q->sema, 1, timeout);
+  if (res == SCE_OK)
+    {
+      ATOMIC_FENCE(ATOMIC_ACQUIRE);
+      return 0;
+    }
+  else if (res == (int)SCE_KERNEL_ERROR_WAIT_TIMEOUT)
+    {
+      pthread_waitq_cancel_(q);
+      return ETIMEDOUT;
+    }
+  sceCHECK(res);
+  return EINVAL;
+}
+
+
+EXTERN void pthread_waitq_wake_(pthread_waitq_t *q)
+{
+  long n;
+  int res;
+
+  // Ordered after the update of the condition that precedes
+  ATOMIC_FENCE(ATOMIC_SEQ_CST);
+  do {
+    n = q->waiters;
+    if (n == 0)
+      return;
+  } while (ATOMIC_CAS_EXPLICIT(&q->waiters, n, n - 1, ATOMIC_RELAXED) != n);
+
+  res = sceKernelSignalSema(q->sema, 1);
+  sceCHECK(res);
+}
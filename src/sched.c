@@ -15,7 +15,16 @@
 
 EXTERN int sched_yield(void)
 {
-  // sceKernelRotateThreadReadyQueue(SCE_KERNEL_TPRI_RUN);
+  int res;
+
+  // Move the current thread behind the other ready threads of its priority
+  res = sceKernelRotateThreadReadyQueue(sceKernelGetThreadCurrentPriority());
+  if (res < 0)
+    {
+      sceCHECK(res);
+      errno = ERROR_errno_sce(res);
+      return -1;
+    }
   return 0;
 }
 